@@ -0,0 +1,521 @@
+////////////////////////////////////////////////////////////
+//
+// Zip File
+// Copyright (C) 2012 Chase Warrington (staff@spacechase0.com)
+//
+// This software is provided 'as-is', without any express or implied warranty.
+// In no event will the authors be held liable for any damages arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it freely,
+// subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented;
+//    you must not claim that you wrote the original software.
+//    If you use this software in a product, an acknowledgment
+//    in the product documentation would be appreciated but is not required.
+//
+// 2. Altered source versions must be plainly marked as such,
+//    and must not be misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any source distribution.
+//
+////////////////////////////////////////////////////////////
+
+// Generates synthetic archives and times the main File operations on them.
+// Every result is printed as one JSON object per line, so runs can be
+// diffed or loaded into whatever.
+//
+// benchmark [--entries=10,1000,...] [--sizes=100,65536,...] [--data=random,text,zeros]
+//           [--depths=1,4] [--iterations=5] [--threads=1] [--max-bytes=268435456] [--dir=.]
+//
+// Scenarios whose total uncompressed size is over --max-bytes are skipped,
+// so the default run doesn't try to make a million 1 GB entries.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <sys/resource.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
+#include "zip/Entry.hpp"
+#include "zip/File.hpp"
+#include "zip/Writer.hpp"
+
+namespace
+{
+	struct Scenario
+	{
+		std::size_t entries;
+		std::size_t size;
+		std::string data;
+		std::size_t depth;
+		
+		std::string getName() const
+		{
+			std::ostringstream ss;
+			ss << "entries=" << entries << ",size=" << size << ",data=" << data << ",depth=" << depth;
+			return ss.str();
+		}
+	};
+	
+	struct Options
+	{
+		std::vector< std::size_t > entries = { 10, 1000, 100000, 1000000 };
+		std::vector< std::size_t > sizes = { 100, 65536, 16777216, 1073741824 };
+		std::vector< std::string > data = { "random", "text" };
+		std::vector< std::size_t > depths = { 1, 4 };
+		std::size_t iterations = 5;
+		unsigned int threads = 1;
+		unsigned long long maxBytes = 256ull << 20;
+		std::string dir = ".";
+	};
+	
+	typedef std::chrono::steady_clock Clock;
+	
+	double getMilliseconds( Clock::time_point start )
+	{
+		return std::chrono::duration< double, std::milli >( Clock::now() - start ).count();
+	}
+	
+	long getPeakRss() // In KB
+	{
+		#ifdef _WIN32
+			PROCESS_MEMORY_COUNTERS counters;
+			GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) );
+			return counters.PeakWorkingSetSize / 1024;
+		#else
+			struct rusage usage;
+			getrusage( RUSAGE_SELF, &usage );
+			return usage.ru_maxrss;
+		#endif
+	}
+	
+	// xorshift, so every run generates the same archives
+	class Generator
+	{
+		public:
+			Generator( unsigned long long seed )
+			   : state( seed * 2654435761ull + 1 )
+			{
+			}
+			
+			unsigned long long next()
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				return state;
+			}
+			
+			std::string makeContents( const std::string& kind, std::size_t size )
+			{
+				static const char* words[] = { "the ", "zip ", "file ", "entry ", "data ", "central ", "directory ", "local ", "header ", "deflate\n" };
+				
+				std::string contents;
+				contents.reserve( size + 16 );
+				if ( kind == "zeros" )
+				{
+					contents.assign( size, '\0' );
+				}
+				else if ( kind == "text" )
+				{
+					while ( contents.length() < size )
+					{
+						contents += words[ next() % 10 ];
+					}
+					contents.resize( size );
+				}
+				else
+				{
+					while ( contents.length() < size )
+					{
+						unsigned long long bits = next();
+						contents.append( reinterpret_cast< const char* >( &bits ), std::min< std::size_t >( 8, size - contents.length() ) );
+					}
+				}
+				
+				return contents;
+			}
+		
+		private:
+			unsigned long long state;
+	};
+	
+	// Sixteen directories at each level, so deeper trees are also wider
+	std::string getPath( const Scenario& scenario, std::size_t i )
+	{
+		std::string path;
+		std::size_t dirs = i;
+		for ( std::size_t level = 1; level < scenario.depth; ++level )
+		{
+			path += "dir" + std::to_string( dirs % 16 ) + "/";
+			dirs /= 16;
+		}
+		
+		return path + "file" + std::to_string( i ) + ".bin";
+	}
+	
+	class Result
+	{
+		public:
+			Result( const Scenario& theScenario, const std::string& theOp )
+			   : scenario( theScenario ),
+			     op( theOp ),
+			     bytes( 0 ),
+			     count( 0 )
+			{
+			}
+			
+			void add( double milliseconds )
+			{
+				times.push_back( milliseconds );
+			}
+			
+			// bytes and count are per sample, for throughput
+			void print( std::ostream& out, unsigned long long theBytes, unsigned long long theCount )
+			{
+				bytes = theBytes;
+				count = theCount;
+				std::sort( times.begin(), times.end() );
+				
+				double total = 0;
+				for ( double time : times )
+				{
+					total += time;
+				}
+				double mean = times.empty() ? 0 : total / times.size();
+				
+				out << "{\"scenario\":\"" << scenario.getName() << "\",\"op\":\"" << op << "\""
+				    << ",\"entries\":" << scenario.entries << ",\"size\":" << scenario.size << ",\"data\":\"" << scenario.data << "\",\"depth\":" << scenario.depth
+				    << ",\"samples\":" << times.size() << ",\"bytes\":" << bytes << ",\"count\":" << count
+				    << ",\"mean_ms\":" << mean << ",\"p50_ms\":" << getPercentile( 0.5 ) << ",\"p90_ms\":" << getPercentile( 0.9 ) << ",\"p99_ms\":" << getPercentile( 0.99 )
+				    << ",\"mb_per_s\":" << ( ( mean > 0 ) ? bytes / ( mean / 1000 ) / ( 1 << 20 ) : 0 )
+				    << ",\"ops_per_s\":" << ( ( mean > 0 ) ? count / ( mean / 1000 ) : 0 )
+				    << ",\"peak_rss_kb\":" << getPeakRss() << "}" << std::endl;
+			}
+		
+		private:
+			const Scenario& scenario;
+			std::string op;
+			unsigned long long bytes;
+			unsigned long long count;
+			std::vector< double > times;
+			
+			double getPercentile( double p ) const
+			{
+				if ( times.empty() )
+				{
+					return 0;
+				}
+				
+				return times[ std::min< std::size_t >( times.size() - 1, static_cast< std::size_t >( p * times.size() ) ) ];
+			}
+	};
+	
+	void runScenario( const Scenario& scenario, const Options& options )
+	{
+		std::string filename = options.dir + "/bench-" + std::to_string( scenario.entries ) + "-" + std::to_string( scenario.size ) + "-" + scenario.data + "-" + std::to_string( scenario.depth ) + ".zip";
+		std::string copyFilename = filename + ".out";
+		unsigned long long totalBytes = static_cast< unsigned long long >( scenario.entries ) * scenario.size;
+		
+		// Written entry by entry, so making the archive doesn't need it all in memory
+		{
+			zip::Writer writer;
+			if ( !writer.open( filename ) )
+			{
+				std::cerr << "Couldn't create " << filename << std::endl;
+				return;
+			}
+			
+			Generator generator( scenario.size );
+			for ( std::size_t i = 0; i < scenario.entries; ++i )
+			{
+				writer.addFile( getPath( scenario, i ), generator.makeContents( scenario.data, scenario.size ) );
+			}
+			writer.finish();
+		}
+		
+		std::string archive;
+		{
+			std::ifstream file( filename.c_str(), std::ifstream::binary );
+			std::ostringstream ss;
+			ss << file.rdbuf();
+			archive = ss.str();
+		}
+		
+		zip::LoadOptions loadOptions;
+		loadOptions.threads = options.threads;
+		zip::SaveOptions saveOptions;
+		saveOptions.threads = options.threads;
+		
+		auto timeLoad = [ & ]( const std::string& op, const std::function< bool( zip::File& ) >& load )
+		{
+			Result result( scenario, op );
+			for ( std::size_t i = 0; i < options.iterations; ++i )
+			{
+				zip::File file;
+				Clock::time_point start = Clock::now();
+				if ( !load( file ) )
+				{
+					std::cerr << op << " failed for " << scenario.getName() << std::endl;
+					return;
+				}
+				result.add( getMilliseconds( start ) );
+			}
+			result.print( std::cout, archive.length(), scenario.entries );
+		};
+		
+		timeLoad( "loadFromFile", [ & ]( zip::File& file ) { return file.loadFromFile( filename, loadOptions ); } );
+		timeLoad( "loadFromMemory", [ & ]( zip::File& file ) { return file.loadFromMemory( archive, loadOptions ); } );
+		
+		// Lookups are timed in batches, since one is too quick for the clock
+		{
+			zip::LoadOptions lazy = loadOptions;
+			lazy.lazy = true;
+			zip::File file;
+			if ( !file.loadFromFile( filename, lazy ) )
+			{
+				std::cerr << "getEntry skipped for " << scenario.getName() << ", couldn't load it" << std::endl;
+			}
+			else
+			{
+				constexpr std::size_t BATCH = 64;
+				Generator generator( 7 );
+				std::vector< std::string > paths;
+				for ( std::size_t i = 0; i < std::min< std::size_t >( scenario.entries * 4, 65536 ); ++i )
+				{
+					paths.push_back( getPath( scenario, generator.next() % scenario.entries ) );
+				}
+				
+				Result result( scenario, "getEntry" );
+				for ( std::size_t i = 0; i + BATCH <= paths.size() or i == 0; i += BATCH )
+				{
+					std::size_t batch = std::min( BATCH, paths.size() - i );
+					Clock::time_point start = Clock::now();
+					for ( std::size_t j = i; j < i + batch; ++j )
+					{
+						if ( file.getEntry( paths[ j ] ) == NULL )
+						{
+							std::cerr << "Missing " << paths[ j ] << std::endl;
+						}
+					}
+					result.add( getMilliseconds( start ) / batch );
+				}
+				result.print( std::cout, 0, 1 );
+			}
+		}
+		
+		// From a lazy load, so each first call inflates
+		{
+			zip::LoadOptions lazy = loadOptions;
+			lazy.lazy = true;
+			Result result( scenario, "getContents" );
+			std::size_t samples = std::min< std::size_t >( scenario.entries, 10000 );
+			bool loaded = true;
+			for ( std::size_t i = 0; i < options.iterations and loaded; ++i )
+			{
+				zip::File file;
+				loaded = file.loadFromFile( filename, lazy );
+				for ( std::size_t j = 0; j < samples and loaded; ++j )
+				{
+					std::string path = getPath( scenario, j * scenario.entries / samples );
+					const zip::Entry* entry = file.getEntry( path );
+					if ( entry == NULL )
+					{
+						std::cerr << "Missing " << path << std::endl;
+						continue;
+					}
+					
+					Clock::time_point start = Clock::now();
+					entry->getContentsView();
+					result.add( getMilliseconds( start ) );
+				}
+			}
+			
+			if ( loaded )
+			{
+				result.print( std::cout, scenario.size, 1 );
+			}
+			else
+			{
+				std::cerr << "getContents skipped for " << scenario.getName() << ", couldn't load it" << std::endl;
+			}
+		}
+		
+		// Everything added fresh, so every entry gets compressed
+		{
+			zip::File file;
+			Generator generator( scenario.size );
+			for ( std::size_t i = 0; i < scenario.entries; ++i )
+			{
+				file.addFile( getPath( scenario, i ), generator.makeContents( scenario.data, scenario.size ) );
+			}
+			
+			Result toMemory( scenario, "saveToMemory" );
+			Result toFile( scenario, "saveToFile" );
+			for ( std::size_t i = 0; i < options.iterations; ++i )
+			{
+				std::string contents;
+				Clock::time_point start = Clock::now();
+				file.saveToMemory( contents, saveOptions );
+				toMemory.add( getMilliseconds( start ) );
+				
+				start = Clock::now();
+				file.saveToFile( copyFilename, saveOptions );
+				toFile.add( getMilliseconds( start ) );
+			}
+			toMemory.print( std::cout, totalBytes, scenario.entries );
+			toFile.print( std::cout, totalBytes, scenario.entries );
+		}
+		
+		// Load, change one entry, save: everything else should be copied as is
+		{
+			Result result( scenario, "roundTrip" );
+			for ( std::size_t i = 0; i < options.iterations; ++i )
+			{
+				Clock::time_point start = Clock::now();
+				zip::File file;
+				file.loadFromFile( filename, loadOptions );
+				file.addFile( getPath( scenario, 0 ), "changed" );
+				file.saveToFile( copyFilename, saveOptions );
+				result.add( getMilliseconds( start ) );
+			}
+			result.print( std::cout, archive.length(), scenario.entries );
+		}
+		
+		std::remove( filename.c_str() );
+		std::remove( copyFilename.c_str() );
+	}
+	
+	template< typename T >
+	std::vector< T > parseList( const std::string& str, const std::function< T( const std::string& ) >& parse )
+	{
+		std::vector< T > list;
+		std::istringstream ss( str );
+		std::string item;
+		while ( std::getline( ss, item, ',' ) )
+		{
+			list.push_back( parse( item ) );
+		}
+		
+		return list;
+	}
+	
+	std::size_t parseSize( const std::string& str )
+	{
+		return std::stoull( str );
+	}
+	
+	std::string parseString( const std::string& str )
+	{
+		return str;
+	}
+}
+
+int main( int argc, char* argv[] )
+{
+	Options options;
+	for ( int i = 1; i < argc; ++i )
+	{
+		std::string arg = argv[ i ];
+		std::size_t equals = arg.find( '=' );
+		std::string name = arg.substr( 0, equals );
+		std::string value = ( equals == std::string::npos ) ? "" : arg.substr( equals + 1 );
+		
+		if ( name == "--entries" )
+		{
+			options.entries = parseList< std::size_t >( value, parseSize );
+		}
+		else if ( name == "--sizes" )
+		{
+			options.sizes = parseList< std::size_t >( value, parseSize );
+		}
+		else if ( name == "--data" )
+		{
+			options.data = parseList< std::string >( value, parseString );
+		}
+		else if ( name == "--depths" )
+		{
+			options.depths = parseList< std::size_t >( value, parseSize );
+		}
+		else if ( name == "--iterations" )
+		{
+			options.iterations = std::max< std::size_t >( 1, parseSize( value ) );
+		}
+		else if ( name == "--threads" )
+		{
+			options.threads = parseSize( value );
+		}
+		else if ( name == "--max-bytes" )
+		{
+			options.maxBytes = parseSize( value );
+		}
+		else if ( name == "--dir" )
+		{
+			options.dir = value;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+	
+	for ( std::size_t entries : options.entries )
+	{
+		for ( std::size_t size : options.sizes )
+		{
+			for ( const std::string& data : options.data )
+			{
+				for ( std::size_t depth : options.depths )
+				{
+					Scenario scenario = { entries, size, data, std::max< std::size_t >( 1, depth ) };
+					if ( entries == 0 or static_cast< unsigned long long >( entries ) * size > options.maxBytes )
+					{
+						continue;
+					}
+					
+					// Each scenario in its own process where we can, so the peak
+					// RSS it reports is its own
+					#ifdef _WIN32
+						runScenario( scenario, options );
+					#else
+						std::cout.flush();
+						pid_t child = fork();
+						if ( child == 0 )
+						{
+							runScenario( scenario, options );
+							std::cout.flush();
+							_exit( 0 );
+						}
+						else if ( child > 0 )
+						{
+							int status;
+							waitpid( child, &status, 0 );
+						}
+						else
+						{
+							runScenario( scenario, options );
+						}
+					#endif
+				}
+			}
+		}
+	}
+	
+	return 0;
+}
@@ -52,7 +52,7 @@ namespace
 		}
 		return str_;
 	}
-
+	
 	void printZipFileStructure( zip::File::ConstIterator it, zip::File::ConstIterator end, const std::string prefix = "\t" )
 	{
 		for ( ; it != end; ++it )
@@ -166,25 +166,31 @@ int zipper( int argc, char* argv[] )
 		std::string filename = argv[ 2 ];
 	#endif
 	
-	std::cout << "Getting file contents..." << std::endl;
-	std::string contents;
-	{
-		std::fstream file( filename.c_str(), std::fstream::in | std::fstream::binary | std::fstream::ate );
-		contents = std::string( file.tellg(), '\0' );
-		file.seekg( 0 );
-		file.read( &contents[ 0 ], contents.length() );
-		file.close();
-	}
+	zip::File file;
+	//file.loadFromFile( "out.zip" );
 	
+	// A whole directory goes in with everything in it
 	std::cout << "Adding to zip..." << std::endl;
+	zip::AddOptions options;
+	options.threads = 0;
+	if ( !file.addDirectoryTree( filename, filename, options ) )
 	{
-		zip::File file;
-		//file.loadFromFile( "out.zip" );
+		std::cout << "Getting file contents..." << std::endl;
+		std::string contents;
+		{
+			std::fstream input( filename.c_str(), std::fstream::in | std::fstream::binary | std::fstream::ate );
+			contents = std::string( input.tellg(), '\0' );
+			input.seekg( 0 );
+			input.read( &contents[ 0 ], contents.length() );
+			input.close();
+		}
+		
 		file.addFile( filename, contents );
-		//file.addFile("README","test");
-		file.saveToFile( "out.zip" );
 	}
 	
+	//file.addFile("README","test");
+	file.saveToFile( "out.zip" );
+	
 	return 0;
 }
 
@@ -0,0 +1,240 @@
+#include "zip/ArchiveBuffer.hpp"
+
+#include <fstream>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace zip
+{
+	namespace priv
+	{
+		ArchiveBuffer::ArchiveBuffer()
+		   : data( NULL ),
+		     size( 0 ),
+		     mapped( false ),
+		     borrowed( false )
+		     #ifdef _WIN32
+		     , fileHandle( INVALID_HANDLE_VALUE ),
+		     mappingHandle( NULL )
+		     #else
+		     , fd( -1 )
+		     #endif
+		{
+		}
+		
+		ArchiveBuffer::~ArchiveBuffer()
+		{
+			close();
+		}
+		
+		bool ArchiveBuffer::map( const std::string& filename )
+		{
+			close();
+			
+			#ifdef _WIN32
+				HANDLE file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+				if ( file == INVALID_HANDLE_VALUE )
+				{
+					return false;
+				}
+				
+				LARGE_INTEGER fileSize;
+				if ( !GetFileSizeEx( file, &fileSize ) or fileSize.QuadPart == 0 )
+				{
+					CloseHandle( file );
+					return false;
+				}
+				
+				HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+				if ( mapping == NULL )
+				{
+					CloseHandle( file );
+					return false;
+				}
+				
+				void* view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+				if ( view == NULL )
+				{
+					CloseHandle( mapping );
+					CloseHandle( file );
+					return false;
+				}
+				
+				fileHandle = file;
+				mappingHandle = mapping;
+				data = static_cast< const char* >( view );
+				size = static_cast< std::size_t >( fileSize.QuadPart );
+			#else
+				int file = ::open( filename.c_str(), O_RDONLY | O_CLOEXEC );
+				if ( file == -1 )
+				{
+					return false;
+				}
+				
+				struct stat info;
+				if ( fstat( file, &info ) != 0 or !S_ISREG( info.st_mode ) or info.st_size == 0 )
+				{
+					::close( file );
+					return false;
+				}
+				
+				void* view = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0 );
+				if ( view == MAP_FAILED )
+				{
+					::close( file );
+					return false;
+				}
+				
+				// The mapping doesn't need it, but copying without going
+				// through user space does
+				fd = file;
+				data = static_cast< const char* >( view );
+				size = static_cast< std::size_t >( info.st_size );
+			#endif
+			
+			mapped = true;
+			return true;
+		}
+		
+		bool ArchiveBuffer::read( const std::string& filename )
+		{
+			close();
+			
+			std::fstream file( filename.c_str(), std::fstream::in | std::fstream::binary );
+			if ( !file )
+			{
+				return false;
+			}
+			
+			// One read if it can be sized. Pipes and the like can't, so they're
+			// read in chunks until they run out.
+			std::streamoff length = -1;
+			if ( file.seekg( 0, std::fstream::end ) )
+			{
+				length = file.tellg();
+			}
+			
+			if ( length >= 0 and file.seekg( 0 ) )
+			{
+				copy.resize( static_cast< std::size_t >( length ) );
+				file.read( &copy[ 0 ], copy.length() );
+				if ( static_cast< std::size_t >( file.gcount() ) != copy.length() )
+				{
+					copy.clear();
+					return false;
+				}
+			}
+			else
+			{
+				constexpr std::size_t CHUNK_SIZE = 1 << 20;
+				
+				file.clear();
+				while ( file )
+				{
+					std::size_t old = copy.length();
+					copy.resize( old + CHUNK_SIZE );
+					file.read( &copy[ old ], CHUNK_SIZE );
+					copy.resize( old + file.gcount() );
+				}
+				
+				if ( !file.eof() )
+				{
+					copy.clear();
+					return false;
+				}
+			}
+			
+			data = copy.data();
+			size = copy.length();
+			return true;
+		}
+		
+		void ArchiveBuffer::assign( const char* theData, std::size_t theSize )
+		{
+			close();
+			
+			copy.assign( theData, theSize );
+			data = copy.data();
+			size = copy.length();
+		}
+		
+		void ArchiveBuffer::assign( std::string&& contents )
+		{
+			close();
+			
+			copy = std::move( contents );
+			data = copy.data();
+			size = copy.length();
+		}
+		
+		void ArchiveBuffer::borrow( const char* theData, std::size_t theSize )
+		{
+			close();
+			
+			// The caller keeps ownership, so this must not outlive theData
+			data = theData;
+			size = theSize;
+			borrowed = true;
+		}
+		
+		void ArchiveBuffer::close()
+		{
+			if ( mapped )
+			{
+				#ifdef _WIN32
+					UnmapViewOfFile( data );
+					CloseHandle( mappingHandle );
+					CloseHandle( fileHandle );
+					mappingHandle = NULL;
+					fileHandle = INVALID_HANDLE_VALUE;
+				#else
+					munmap( const_cast< char* >( data ), size );
+					::close( fd );
+					fd = -1;
+				#endif
+			}
+			
+			copy.clear();
+			data = NULL;
+			size = 0;
+			mapped = false;
+			borrowed = false;
+		}
+		
+		const char* ArchiveBuffer::getData() const
+		{
+			return data;
+		}
+		
+		std::size_t ArchiveBuffer::getSize() const
+		{
+			return size;
+		}
+		
+		bool ArchiveBuffer::isMapped() const
+		{
+			return mapped;
+		}
+		
+		bool ArchiveBuffer::isBorrowed() const
+		{
+			return borrowed;
+		}
+		
+		int ArchiveBuffer::getDescriptor() const
+		{
+			#ifdef _WIN32
+				return -1;
+			#else
+				return fd;
+			#endif
+		}
+	}
+}
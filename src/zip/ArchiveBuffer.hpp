@@ -0,0 +1,57 @@
+#ifndef ZIP_ARCHIVEBUFFER_HPP
+#define ZIP_ARCHIVEBUFFER_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace zip
+{
+	namespace priv
+	{
+		// The raw bytes of an archive. Either a read-only memory mapping of
+		// the file (so the page cache is shared with anyone else mapping it),
+		// or a plain copy if mapping isn't possible.
+		class ArchiveBuffer
+		{
+			public:
+				ArchiveBuffer();
+				~ArchiveBuffer();
+				
+				ArchiveBuffer( const ArchiveBuffer& other ) = delete;
+				ArchiveBuffer& operator = ( const ArchiveBuffer& other ) = delete;
+				
+				bool map( const std::string& filename );
+				bool read( const std::string& filename );
+				void assign( const char* theData, std::size_t theSize );
+				void assign( std::string&& contents );
+				void borrow( const char* theData, std::size_t theSize );
+				void close();
+				
+				const char* getData() const;
+				std::size_t getSize() const;
+				bool isMapped() const;
+				bool isBorrowed() const; // If so, it mustn't be used past the call that borrowed it
+				
+				// The file behind a mapping, for handing ranges of it to the
+				// kernel to copy; -1 if there isn't one (always on Windows)
+				int getDescriptor() const;
+			
+			private:
+				const char* data;
+				std::size_t size;
+				bool mapped;
+				bool borrowed;
+				
+				std::string copy;
+				
+				#ifdef _WIN32
+				void* fileHandle;
+				void* mappingHandle;
+				#else
+				int fd;
+				#endif
+		};
+	}
+}
+
+#endif // ZIP_ARCHIVEBUFFER_HPP
@@ -0,0 +1,202 @@
+#include "zip/ArchiveCache.hpp"
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+namespace
+{
+	// Each entry, its path, its place in its parent and its node in the
+	// index. Anything inflated later is counted separately.
+	sf::Uint64 getCatalogSize( const zip::priv::EntryBase& entry )
+	{
+		constexpr sf::Uint64 OVERHEAD = sizeof( zip::Entry ) + sizeof( zip::priv::EntryPtr ) + 4 * sizeof( void* );
+		
+		sf::Uint64 size = 0;
+		for ( auto it = entry.begin(); it != entry.end(); ++it )
+		{
+			size += OVERHEAD + ( * it )->getPathView().length() + getCatalogSize( * it->get() );
+		}
+		
+		return size;
+	}
+}
+
+namespace zip
+{
+	ArchiveCache::ArchiveCache( const CacheOptions& theOptions )
+	   : options( theOptions ),
+	     memory( 0 )
+	{
+		options.load.lazy = true;
+	}
+	
+	ArchiveCache::Handle ArchiveCache::open( const std::string& filename )
+	{
+		auto now = std::chrono::steady_clock::now();
+		std::vector< Handle > evicted;
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			auto it = archives.find( filename );
+			if ( it != archives.end() and now - it->second.checked < std::chrono::milliseconds( options.recheckMilliseconds ) )
+			{
+				Handle file = it->second.file;
+				touch( it->second );
+				evicted = evict();
+				return file;
+			}
+		}
+		
+		// Either it isn't cached or it's time to make sure it's the same
+		// file, and neither needs the lock
+		priv::FileIdentity identity;
+		if ( !priv::getFileIdentity( filename, identity ) )
+		{
+			remove( filename );
+			return NULL;
+		}
+		
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			auto it = archives.find( filename );
+			if ( it != archives.end() and it->second.identity == identity )
+			{
+				Handle file = it->second.file;
+				it->second.checked = now;
+				touch( it->second );
+				evicted = evict();
+				return file;
+			}
+		}
+		
+		// Other opens carry on while this loads. If the file changes again
+		// in the meantime, the identity won't match next time it's checked.
+		std::shared_ptr< File > file( new File() );
+		if ( !file->loadFromFile( filename, options.load ) )
+		{
+			print( "Couldn't load " << filename );
+			remove( filename );
+			return NULL;
+		}
+		sf::Uint64 size = getCatalogSize( * file ) + sizeof( File ) + filename.length();
+		
+		Handle stale;
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			auto it = archives.find( filename );
+			if ( it != archives.end() and it->second.identity == identity )
+			{
+				// Someone else got here first
+				Handle file = it->second.file;
+				touch( it->second );
+				evicted = evict();
+				return file;
+			}
+			else if ( it != archives.end() )
+			{
+				stale = take( it );
+			}
+			
+			uses.push_front( filename );
+			Cached& cached = archives[ filename ];
+			cached.file = file;
+			cached.identity = identity;
+			cached.checked = now;
+			cached.catalog = size;
+			cached.memory = size;
+			cached.use = uses.begin();
+			memory += size;
+			
+			// Loading's slow enough anyway that everything can be brought
+			// up to date, instead of just what's opened
+			for ( auto it = archives.begin(); it != archives.end(); ++it )
+			{
+				recount( it->second );
+			}
+			evicted = evict();
+		}
+		
+		return file;
+	}
+	
+	void ArchiveCache::remove( const std::string& filename )
+	{
+		Handle removed;
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			auto it = archives.find( filename );
+			if ( it != archives.end() )
+			{
+				removed = take( it );
+			}
+		}
+	}
+	
+	void ArchiveCache::clear()
+	{
+		std::unordered_map< std::string, Cached > removed;
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			removed.swap( archives );
+			uses.clear();
+			memory = 0;
+		}
+	}
+	
+	std::size_t ArchiveCache::getCount() const
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		return archives.size();
+	}
+	
+	sf::Uint64 ArchiveCache::getMemoryUsage() const
+	{
+		// Including anything inflated since each was last touched
+		std::lock_guard< std::mutex > lock( mutex );
+		sf::Uint64 total = 0;
+		for ( auto it = archives.begin(); it != archives.end(); ++it )
+		{
+			total += it->second.catalog + it->second.file->getInflatedSize();
+		}
+		
+		return total;
+	}
+	
+	void ArchiveCache::recount( Cached& cached )
+	{
+		sf::Uint64 now = cached.catalog + cached.file->getInflatedSize();
+		memory += now - cached.memory;
+		cached.memory = now;
+	}
+	
+	void ArchiveCache::touch( Cached& cached )
+	{
+		recount( cached );
+		uses.splice( uses.begin(), uses, cached.use );
+	}
+	
+	ArchiveCache::Handle ArchiveCache::take( std::unordered_map< std::string, Cached >::iterator it )
+	{
+		Handle file = it->second.file;
+		memory -= it->second.memory;
+		uses.erase( it->second.use );
+		archives.erase( it );
+		return file;
+	}
+	
+	std::vector< ArchiveCache::Handle > ArchiveCache::evict()
+	{
+		std::vector< Handle > evicted;
+		while ( archives.size() > 1 and ( memory > options.memory or archives.size() > options.descriptors ) )
+		{
+			print( "Evicting " << uses.back() );
+			evicted.push_back( take( archives.find( uses.back() ) ) );
+		}
+		
+		return evicted;
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef ZIP_ARCHIVECACHE_HPP
+#define ZIP_ARCHIVECACHE_HPP
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <SFML/Config.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "zip/Disk.hpp"
+#include "zip/File.hpp"
+
+namespace zip
+{
+	struct CacheOptions
+	{
+		// Roughly what the cached catalogs (entries, paths and the index)
+		// and whatever's been inflated out of them can take up between
+		// them. The archives themselves are mapped, so they're the page
+		// cache's problem.
+		sf::Uint64 memory = 256 << 20;
+		
+		// How many archives can be kept open at once, since each has a
+		// mapping and a file descriptor
+		std::size_t descriptors = 256;
+		
+		// How long a cached archive is trusted before checking the file
+		// hasn't changed, so most opens don't touch the disk at all; 0
+		// checks every time
+		unsigned int recheckMilliseconds = 1000;
+		
+		// Used for every load, except that lazy is always on
+		LoadOptions load;
+	};
+	
+	// Loaded archives, shared by everyone in the process who opens the same
+	// file, so only the first open pays for parsing the central directory.
+	// Safe to use from any number of threads at once, and so are the
+	// handles it gives out.
+	class ArchiveCache
+	{
+		public:
+			// Read-only, so it can be shared; entries are inflated the first
+			// time they're asked for, like any lazily loaded File
+			typedef std::shared_ptr< const File > Handle;
+			
+			ArchiveCache( const CacheOptions& theOptions = CacheOptions() );
+			
+			ArchiveCache( const ArchiveCache& other ) = delete;
+			ArchiveCache& operator = ( const ArchiveCache& other ) = delete;
+			
+			// From the cache if the file is the same one that was loaded
+			// before (or it was checked too recently to look again), or NULL
+			// if it can't be loaded. Handles stay usable after being evicted
+			// or going stale, but keep their archive open until they're gone.
+			// Whatever was used least recently is evicted to stay within
+			// budget; the one just opened always stays. What's inflated
+			// through a handle counts from the next open of the same file,
+			// or of one that isn't cached.
+			Handle open( const std::string& filename );
+			
+			void remove( const std::string& filename );
+			void clear();
+			
+			std::size_t getCount() const;
+			sf::Uint64 getMemoryUsage() const;
+		
+		private:
+			struct Cached
+			{
+				Handle file;
+				priv::FileIdentity identity;
+				std::chrono::steady_clock::time_point checked;
+				sf::Uint64 catalog;
+				sf::Uint64 memory; // The catalog and what was inflated, as of the last time it was touched
+				std::list< std::string >::iterator use; // Where it is in uses
+			};
+			
+			CacheOptions options;
+			
+			mutable std::mutex mutex;
+			std::unordered_map< std::string, Cached > archives;
+			std::list< std::string > uses; // Most recently used first
+			sf::Uint64 memory;
+			
+			// All need mutex locked. The last two give back what they took
+			// out so it can be destroyed after unlocking.
+			void recount( Cached& cached ); // Catches up on anything inflated since
+			void touch( Cached& cached ); // Moves it to the front, and recounts it
+			Handle take( std::unordered_map< std::string, Cached >::iterator it );
+			std::vector< Handle > evict();
+	};
+}
+
+#endif // ZIP_ARCHIVECACHE_HPP
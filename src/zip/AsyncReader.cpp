@@ -0,0 +1,671 @@
+#include "zip/AsyncReader.hpp"
+
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <util/String.hpp>
+
+#ifdef ZIP_IO_URING
+	#include <fcntl.h>
+	#include <linux/io_uring.h>
+	#include <sys/eventfd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+#include "zip/ArchiveBuffer.hpp"
+#include "zip/Crc32.hpp"
+#include "zip/Format.hpp"
+#include "zip/Parallel.hpp"
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+namespace zip
+{
+	namespace priv
+	{
+		struct PendingRead
+		{
+			std::size_t index;
+			std::string path;
+			const AsyncReader::Location* location; // NULL if it isn't in the archive
+			std::shared_ptr< AsyncReader::Completion > completion;
+			
+			// Starts at the local header; only used with io_uring
+			std::string buffer;
+			std::size_t done = 0;
+			#ifdef ZIP_IO_URING
+			iovec iov;
+			#endif
+		};
+		
+		#ifdef ZIP_IO_URING
+		// Just enough of liburing to queue up reads and get them back, done
+		// with the raw system calls so there's nothing else to link. One
+		// thread owns the rings; everyone else hands it reads through a
+		// queue, and pokes an eventfd it always has a read waiting on.
+		class IoRing
+		{
+			public:
+				IoRing( int theFd, AsyncReader& theReader )
+				   : fd( theFd ),
+				     reader( theReader ),
+				     ringFd( -1 ),
+				     eventFd( -1 ),
+				     sqRing( MAP_FAILED ),
+				     cqRing( MAP_FAILED ),
+				     sqes( MAP_FAILED ),
+				     stopping( false ),
+				     broken( false )
+				{
+					std::memset( &params, 0, sizeof( params ) );
+					ringFd = syscall( __NR_io_uring_setup, 64, &params );
+					if ( ringFd < 0 )
+					{
+						throw std::runtime_error( "io_uring_setup failed: " + std::string( std::strerror( errno ) ) );
+					}
+					
+					sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+					cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+					sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+					
+					bool single = false;
+					#ifdef IORING_FEAT_SINGLE_MMAP
+						single = ( params.features & IORING_FEAT_SINGLE_MMAP );
+						if ( single )
+						{
+							sqRingSize = cqRingSize = std::max( sqRingSize, cqRingSize );
+						}
+					#endif
+					
+					sqRing = mmap( NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING );
+					cqRing = single ? sqRing : mmap( NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING );
+					sqes = mmap( NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES );
+					eventFd = eventfd( 0, EFD_CLOEXEC );
+					if ( sqRing == MAP_FAILED or cqRing == MAP_FAILED or sqes == MAP_FAILED or eventFd < 0 )
+					{
+						release();
+						throw std::runtime_error( "Couldn't map io_uring rings." );
+					}
+					
+					char* sq = static_cast< char* >( sqRing );
+					sqHead = reinterpret_cast< unsigned* >( sq + params.sq_off.head );
+					sqTail = reinterpret_cast< unsigned* >( sq + params.sq_off.tail );
+					sqMask = reinterpret_cast< unsigned* >( sq + params.sq_off.ring_mask );
+					sqArray = reinterpret_cast< unsigned* >( sq + params.sq_off.array );
+					char* cq = static_cast< char* >( cqRing );
+					cqHead = reinterpret_cast< unsigned* >( cq + params.cq_off.head );
+					cqTail = reinterpret_cast< unsigned* >( cq + params.cq_off.tail );
+					cqMask = reinterpret_cast< unsigned* >( cq + params.cq_off.ring_mask );
+					cqes = reinterpret_cast< io_uring_cqe* >( cq + params.cq_off.cqes );
+					
+					eventIov.iov_base = &eventValue;
+					eventIov.iov_len = sizeof( eventValue );
+					
+					thread = std::thread( &IoRing::run, this );
+				}
+				
+				~IoRing()
+				{
+					{
+						std::lock_guard< std::mutex > lock( mutex );
+						stopping = true;
+					}
+					wake();
+					thread.join();
+					release();
+				}
+				
+				void submit( std::unique_ptr< PendingRead > read )
+				{
+					{
+						std::lock_guard< std::mutex > lock( mutex );
+						if ( !broken )
+						{
+							queue.push_back( read.release() );
+						}
+					}
+					
+					if ( read )
+					{
+						// The ring's given up, so the pool reads it instead
+						reader.finish( std::move( read ), 0 );
+						return;
+					}
+					wake();
+				}
+			
+			private:
+				int fd;
+				AsyncReader& reader;
+				
+				int ringFd;
+				int eventFd;
+				io_uring_params params;
+				void* sqRing;
+				void* cqRing;
+				void* sqes;
+				std::size_t sqRingSize;
+				std::size_t cqRingSize;
+				std::size_t sqesSize;
+				unsigned* sqHead;
+				unsigned* sqTail;
+				unsigned* sqMask;
+				unsigned* sqArray;
+				unsigned* cqHead;
+				unsigned* cqTail;
+				unsigned* cqMask;
+				io_uring_cqe* cqes;
+				
+				sf::Uint64 eventValue;
+				iovec eventIov;
+				
+				std::mutex mutex;
+				std::deque< PendingRead* > queue;
+				bool stopping;
+				bool broken;
+				std::thread thread;
+				
+				// Reads the kernel might still be writing into after giving
+				// up, kept until the ring's gone
+				std::vector< std::unique_ptr< PendingRead > > abandoned;
+				
+				void wake()
+				{
+					sf::Uint64 one = 1;
+					while ( ::write( eventFd, &one, sizeof( one ) ) < 0 and errno == EINTR );
+				}
+				
+				void release()
+				{
+					if ( sqes != MAP_FAILED )
+					{
+						munmap( sqes, sqesSize );
+					}
+					if ( cqRing != MAP_FAILED and cqRing != sqRing )
+					{
+						munmap( cqRing, cqRingSize );
+					}
+					if ( sqRing != MAP_FAILED )
+					{
+						munmap( sqRing, sqRingSize );
+					}
+					if ( eventFd >= 0 )
+					{
+						::close( eventFd );
+					}
+					::close( ringFd );
+				}
+				
+				// Only ever called from run(), so nothing else touches the tail
+				void push( sf::Uint64 userData, iovec* iov, sf::Uint64 offset, int file )
+				{
+					unsigned tail = ( * sqTail );
+					unsigned index = tail & ( * sqMask );
+					io_uring_sqe& sqe = static_cast< io_uring_sqe* >( sqes )[ index ];
+					std::memset( &sqe, 0, sizeof( sqe ) );
+					sqe.opcode = IORING_OP_READV; // Plain READ needs 5.6
+					sqe.fd = file;
+					sqe.off = offset;
+					sqe.addr = reinterpret_cast< sf::Uint64 >( iov );
+					sqe.len = 1;
+					sqe.user_data = userData;
+					sqArray[ index ] = index;
+					__atomic_store_n( sqTail, tail + 1, __ATOMIC_RELEASE );
+				}
+				
+				void run()
+				{
+					std::deque< PendingRead* > waiting; // Including short reads going back in for the rest
+					std::unordered_set< PendingRead* > submitted; // Pushed, whether or not the kernel has them yet
+					unsigned int toSubmit = 0;
+					bool listening = false;
+					while ( true )
+					{
+						if ( !listening )
+						{
+							push( 0, &eventIov, 0, eventFd );
+							++toSubmit;
+							listening = true;
+						}
+						
+						bool stop;
+						{
+							std::lock_guard< std::mutex > lock( mutex );
+							waiting.insert( waiting.end(), queue.begin(), queue.end() );
+							queue.clear();
+							stop = stopping;
+						}
+						
+						// Never more than the rings hold, counting the eventfd read
+						while ( !waiting.empty() and submitted.size() + 1 < params.sq_entries )
+						{
+							PendingRead* read = waiting.front();
+							waiting.pop_front();
+							read->iov.iov_base = &read->buffer[ read->done ];
+							read->iov.iov_len = std::min< std::size_t >( read->buffer.length() - read->done, 1 << 30 );
+							push( reinterpret_cast< sf::Uint64 >( read ), &read->iov, read->location->headerOffset + read->done, fd );
+							submitted.insert( read );
+							++toSubmit;
+						}
+						
+						if ( stop and submitted.empty() and waiting.empty() )
+						{
+							break;
+						}
+						
+						int ret = syscall( __NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+						if ( ret >= 0 )
+						{
+							toSubmit -= std::min< unsigned int >( ret, toSubmit );
+						}
+						else if ( errno != EINTR and errno != EAGAIN and errno != EBUSY )
+						{
+							// Shouldn't happen with what we give it, but don't leave
+							// anyone waiting forever if it does. Everything's read
+							// on the pool instead, like anything submitted from now
+							// on; what the kernel might have starts again in a new
+							// buffer, since the old one can't be trusted (or freed).
+							print( "io_uring_enter failed, reading on the pool instead: " << std::strerror( errno ) ); // Before anything else can change errno
+							{
+								std::lock_guard< std::mutex > lock( mutex );
+								broken = true;
+								waiting.insert( waiting.end(), queue.begin(), queue.end() );
+								queue.clear();
+							}
+							for ( PendingRead* read : submitted )
+							{
+								std::unique_ptr< PendingRead > copy( new PendingRead() );
+								copy->index = read->index;
+								copy->path = read->path;
+								copy->location = read->location;
+								copy->completion = read->completion;
+								copy->buffer.resize( read->buffer.length() );
+								abandoned.emplace_back( read );
+								reader.finish( std::move( copy ), 0 );
+							}
+							for ( std::size_t i = 0; i < waiting.size(); ++i )
+							{
+								reader.finish( std::unique_ptr< PendingRead >( waiting[ i ] ), 0 );
+							}
+							return;
+						}
+						
+						unsigned head = ( * cqHead );
+						unsigned tail = __atomic_load_n( cqTail, __ATOMIC_ACQUIRE );
+						for ( ; head != tail; ++head )
+						{
+							const io_uring_cqe& cqe = cqes[ head & ( * cqMask ) ];
+							if ( cqe.user_data == 0 )
+							{
+								listening = false;
+								continue;
+							}
+							
+							PendingRead* read = reinterpret_cast< PendingRead* >( cqe.user_data );
+							submitted.erase( read );
+							if ( cqe.res < 0 )
+							{
+								reader.finish( std::unique_ptr< PendingRead >( read ), -cqe.res );
+								continue;
+							}
+							
+							read->done += cqe.res;
+							if ( cqe.res > 0 and read->done < read->buffer.length() )
+							{
+								waiting.push_front( read );
+							}
+							else
+							{
+								reader.finish( std::unique_ptr< PendingRead >( read ), 0 ); // Short if the file ended early
+							}
+						}
+						__atomic_store_n( cqHead, head, __ATOMIC_RELEASE );
+					}
+				}
+		};
+		#else
+		// Never made, so AsyncReader always uses the pool
+		class IoRing
+		{
+			public:
+				void submit( std::unique_ptr< PendingRead > read )
+				{
+				}
+		};
+		#endif
+	}
+	
+	AsyncReader::AsyncReader( unsigned int threads )
+	   : fileSize( 0 ),
+	     fd( -1 ),
+	     pool( new priv::ThreadPool( threads ) ),
+	     outstanding( 0 )
+	{
+	}
+	
+	AsyncReader::~AsyncReader()
+	{
+		close();
+	}
+	
+	bool AsyncReader::open( const std::string& filename, bool useIoUring )
+	{
+		close();
+		
+		// The directory's only read once, so a mapping's fine even when the
+		// entries themselves will be read some other way
+		std::shared_ptr< priv::ArchiveBuffer > mapped( new priv::ArchiveBuffer() );
+		if ( !mapped->map( filename ) and !mapped->read( filename ) )
+		{
+			return false;
+		}
+		
+		try
+		{
+			priv::EndCentralDirectoryStructure ecd;
+			std::vector< priv::CentralDirectoryStructure > cds;
+			if ( !priv::readDirectory( mapped->getData(), mapped->getSize(), ecd, cds ) )
+			{
+				print( "no end central dir" );
+				return false;
+			}
+			
+			index.reserve( cds.size() );
+			for ( std::size_t i = 0; i < cds.size(); ++i )
+			{
+				const priv::CentralDirectoryStructure& cd = cds[ i ];
+				Location& location = index[ cd.filename ];
+				location.headerOffset = cd.localHeaderOffset;
+				location.sizeCompressed = cd.sizeCompressed;
+				location.sizeNormal = cd.sizeNormal;
+				location.compressType = cd.compressType;
+				location.crc32 = cd.crc32;
+				location.headerGuess = 30 + cd.filename.length() + cd.extra.length() + 1024; // Local extras can be a bit bigger
+				location.dir = ( !cd.filename.empty() and cd.filename.back() == '/' );
+			}
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error reading zip directory, exception: " << exception.what() );
+			index.clear();
+			return false;
+		}
+		fileSize = mapped->getSize();
+		
+		#ifdef ZIP_IO_URING
+		if ( useIoUring )
+		{
+			fd = ::open( filename.c_str(), O_RDONLY | O_CLOEXEC );
+			try
+			{
+				if ( fd >= 0 )
+				{
+					ring.reset( new priv::IoRing( fd, * this ) );
+				}
+			}
+			catch ( std::exception& exception )
+			{
+				print( "No io_uring, using threads: " << exception.what() );
+			}
+			
+			if ( !ring and fd >= 0 )
+			{
+				::close( fd );
+				fd = -1;
+			}
+		}
+		#endif
+		
+		if ( !ring )
+		{
+			archive = mapped;
+		}
+		
+		return true;
+	}
+	
+	void AsyncReader::close()
+	{
+		wait();
+		ring.reset();
+		#ifdef ZIP_IO_URING
+		if ( fd >= 0 )
+		{
+			::close( fd );
+		}
+		#endif
+		fd = -1;
+		archive.reset();
+		index.clear();
+		fileSize = 0;
+	}
+	
+	std::vector< std::future< std::string > > AsyncReader::extract( const std::vector< std::string >& paths )
+	{
+		std::shared_ptr< std::vector< std::promise< std::string > > > promises( new std::vector< std::promise< std::string > >( paths.size() ) );
+		std::vector< std::future< std::string > > futures;
+		futures.reserve( paths.size() );
+		for ( std::size_t i = 0; i < paths.size(); ++i )
+		{
+			futures.push_back( ( * promises )[ i ].get_future() );
+		}
+		
+		std::shared_ptr< Completion > completion( new Completion( [ promises ]( std::size_t i, std::string contents, std::exception_ptr error )
+		{
+			if ( error )
+			{
+				( * promises )[ i ].set_exception( error );
+			}
+			else
+			{
+				( * promises )[ i ].set_value( std::move( contents ) );
+			}
+		} ) );
+		extract( paths, completion );
+		
+		return futures;
+	}
+	
+	void AsyncReader::extract( const std::vector< std::string >& paths, const Callback& callback )
+	{
+		std::shared_ptr< Completion > completion( new Completion( [ paths, callback ]( std::size_t i, std::string contents, std::exception_ptr error )
+		{
+			callback( paths[ i ], std::move( contents ), error );
+		} ) );
+		extract( paths, completion );
+	}
+	
+	void AsyncReader::extract( const std::vector< std::string >& paths, const std::shared_ptr< Completion >& completion )
+	{
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			outstanding += paths.size();
+		}
+		
+		for ( std::size_t i = 0; i < paths.size(); ++i )
+		{
+			auto it = index.find( paths[ i ] );
+			std::unique_ptr< priv::PendingRead > read( new priv::PendingRead() );
+			read->index = i;
+			read->path = paths[ i ];
+			read->location = ( it == index.end() ) ? NULL : &it->second;
+			read->completion = completion;
+			
+			// Anything that doesn't need reading goes straight to the pool
+			const Location* location = read->location;
+			if ( ring and location != NULL and !location->dir and location->headerOffset < fileSize )
+			{
+				read->buffer.resize( std::min< sf::Uint64 >( fileSize - location->headerOffset, location->headerGuess + location->sizeCompressed ) );
+				ring->submit( std::move( read ) );
+			}
+			else
+			{
+				finish( std::move( read ), 0 );
+			}
+		}
+	}
+	
+	void AsyncReader::finish( std::unique_ptr< priv::PendingRead > theRead, int error )
+	{
+		// std::function needs to be copyable, so the pointer goes in bare
+		priv::PendingRead* raw = theRead.release();
+		pool->post( [ this, raw, error ]()
+		{
+			// Counted as handed over even if the callback throws, which the
+			// pool just drops; the read goes first, since it's declared after
+			class Done
+			{
+				public:
+					Done( AsyncReader& theReader )
+					   : reader( theReader )
+					{
+					}
+					
+					~Done()
+					{
+						std::lock_guard< std::mutex > lock( reader.mutex );
+						if ( --reader.outstanding == 0 )
+						{
+							reader.drained.notify_all();
+						}
+					}
+				
+				private:
+					AsyncReader& reader;
+			} done( * this );
+			
+			std::unique_ptr< priv::PendingRead > read( raw );
+			const Location* location = read->location;
+			std::string contents;
+			std::exception_ptr failure;
+			try
+			{
+				if ( location == NULL )
+				{
+					throw std::runtime_error( "No entry " + read->path + " in the archive." );
+				}
+				else if ( error != 0 )
+				{
+					throw std::runtime_error( "Couldn't read " + read->path + ": " + std::strerror( error ) );
+				}
+				else if ( location->compressType != priv::Compression::None and location->compressType != priv::Compression::Deflated )
+				{
+					throw std::runtime_error( "Unsupported compression type " + util::toString( location->compressType ) + " for file " + read->path + "." );
+				}
+				
+				if ( !location->dir )
+				{
+					// Straight from the mapping, or what io_uring read for us
+					std::string_view data;
+					if ( archive )
+					{
+						data = std::string_view( archive->getData(), archive->getSize() ).substr( std::min< sf::Uint64 >( location->headerOffset, archive->getSize() ) );
+					}
+					else
+					{
+						readRest( * read );
+						data = read->buffer;
+					}
+					
+					contents = getContents( * read, data );
+				}
+			}
+			catch ( ... )
+			{
+				contents.clear();
+				failure = std::current_exception();
+			}
+			
+			// Exactly once, whatever it does
+			( * read->completion )( read->index, std::move( contents ), failure );
+		} );
+	}
+	
+	std::string AsyncReader::getContents( priv::PendingRead& read, std::string_view data )
+	{
+		const Location& location = ( * read.location );
+		
+		priv::MemoryBuffer buffer( data.data(), data.length() );
+		std::istream ss( &buffer );
+		priv::readLocalFileHeader( ss );
+		if ( !ss )
+		{
+			throw std::runtime_error( "Local header for " + read.path + " is cut off." );
+		}
+		
+		std::size_t start = ss.tellg();
+		if ( start + location.sizeCompressed > data.length() and !archive and fd >= 0 )
+		{
+			// The local extra field was bigger than we guessed, so the end
+			// still needs reading. Rare enough to just do it here.
+			read.buffer.resize( start + location.sizeCompressed );
+			readRest( read );
+			data = read.buffer;
+		}
+		
+		if ( start + location.sizeCompressed > data.length() )
+		{
+			throw std::runtime_error( "Data for " + read.path + " is cut off." );
+		}
+		
+		std::string_view raw = data.substr( start, location.sizeCompressed );
+		std::string contents;
+		sf::Uint32 crc = 0;
+		if ( location.compressType == priv::Compression::Deflated )
+		{
+			contents = priv::getInflated( raw, location.sizeNormal, &crc );
+		}
+		else
+		{
+			crc = priv::getCrc32( raw );
+			contents.assign( raw.data(), raw.length() );
+		}
+		
+		if ( crc != location.crc32 )
+		{
+			throw std::runtime_error( "CRC-32 doesn't match for " + read.path + "." );
+		}
+		
+		return contents;
+	}
+	
+	void AsyncReader::readRest( priv::PendingRead& read )
+	{
+		// Nothing left unless the ring gave up partway, or the file's short
+		#ifdef ZIP_IO_URING
+		while ( read.done < read.buffer.length() )
+		{
+			ssize_t got = pread( fd, &read.buffer[ read.done ], read.buffer.length() - read.done, read.location->headerOffset + read.done );
+			if ( got <= 0 and !( got < 0 and errno == EINTR ) )
+			{
+				break;
+			}
+			read.done += std::max< ssize_t >( got, 0 );
+		}
+		#endif
+		read.buffer.resize( read.done );
+	}
+	
+	void AsyncReader::wait()
+	{
+		std::unique_lock< std::mutex > lock( mutex );
+		drained.wait( lock, [ this ]() { return outstanding == 0; } );
+	}
+	
+	bool AsyncReader::isUsingIoUring() const
+	{
+		return static_cast< bool >( ring );
+	}
+}
@@ -0,0 +1,105 @@
+#ifndef ZIP_ASYNCREADER_HPP
+#define ZIP_ASYNCREADER_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <SFML/Config.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// io_uring is used where the headers are there to build it, unless
+// ZIP_NO_IO_URING is defined. Whether the kernel actually lets us have one
+// is checked when opening, and everything falls back to the thread pool
+// if not.
+#if defined( __linux__ ) and !defined( ZIP_NO_IO_URING )
+	#if __has_include( <linux/io_uring.h> )
+		#define ZIP_IO_URING
+	#endif
+#endif
+
+namespace zip
+{
+	namespace priv
+	{
+		class ArchiveBuffer;
+		class IoRing;
+		class ThreadPool;
+		struct PendingRead;
+	}
+	
+	// Gets entries out of an archive without blocking the thread that asks
+	// for them. Opening only reads the central directory. After that, each
+	// entry's compressed data is read straight from the file with io_uring
+	// (or, without it, on the pool from a mapping of the file), and
+	// inflated on the pool as each read lands. Any number of batches can be
+	// in flight at once, from any number of threads.
+	class AsyncReader
+	{
+		public:
+			// Gets the contents, or the exception that stopped it; called on
+			// one of the pool's threads
+			typedef std::function< void( const std::string& path, std::string contents, std::exception_ptr error ) > Callback;
+			
+			AsyncReader( unsigned int threads = 0 ); // How many to inflate on; 0 means one per core
+			~AsyncReader(); // Waits for everything in flight
+			
+			AsyncReader( const AsyncReader& other ) = delete;
+			AsyncReader& operator = ( const AsyncReader& other ) = delete;
+			
+			// Both wait for anything still in flight first
+			bool open( const std::string& filename, bool useIoUring = true );
+			void close();
+			
+			// Paths are as they are in the archive. Ones that aren't there
+			// fail with std::runtime_error, and directories come back empty.
+			// The CRC-32 of everything is checked.
+			std::vector< std::future< std::string > > extract( const std::vector< std::string >& paths );
+			void extract( const std::vector< std::string >& paths, const Callback& callback );
+			
+			void wait(); // Until everything asked for so far has been handed over
+			
+			bool isUsingIoUring() const;
+		
+		private:
+			struct Location
+			{
+				sf::Uint64 headerOffset;
+				sf::Uint64 sizeCompressed;
+				sf::Uint64 sizeNormal;
+				sf::Uint16 compressType;
+				sf::Uint32 crc32;
+				std::size_t headerGuess; // What the local header probably takes, from the central one
+				bool dir;
+			};
+			
+			typedef std::function< void( std::size_t index, std::string contents, std::exception_ptr error ) > Completion;
+			
+			std::unordered_map< std::string, Location > index;
+			sf::Uint64 fileSize;
+			int fd; // Just for io_uring
+			std::shared_ptr< priv::ArchiveBuffer > archive; // Just without it
+			
+			std::unique_ptr< priv::ThreadPool > pool;
+			std::unique_ptr< priv::IoRing > ring; // Torn down before the pool, since it posts to it
+			
+			std::mutex mutex;
+			std::condition_variable drained;
+			std::size_t outstanding; // Asked for, but not handed over yet
+			
+			void extract( const std::vector< std::string >& paths, const std::shared_ptr< Completion >& completion );
+			void finish( std::unique_ptr< priv::PendingRead > read, int error ); // Everything after the read happens on the pool
+			std::string getContents( priv::PendingRead& read, std::string_view data );
+			void readRest( priv::PendingRead& read ); // Whatever the ring didn't get, then trims the buffer to what's there
+			
+			friend class priv::IoRing;
+			friend struct priv::PendingRead;
+	};
+}
+
+#endif // ZIP_ASYNCREADER_HPP
@@ -0,0 +1,339 @@
+#include "zip/Checkpoints.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <util/String.hpp>
+#include <zlib.h>
+
+#include "zip/Crc32.hpp"
+#include "zip/Format.hpp"
+#include "zip/Parallel.hpp"
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+namespace
+{
+	using namespace zip::priv;
+	
+	constexpr std::size_t WINDOW_SIZE = 32768;
+	constexpr std::size_t MAX_CHUNK = 1 << 30; // What fits in avail_in/avail_out
+	constexpr std::size_t MAX_EXTRA = 32768; // Leaves plenty of the 64 KB for everything else
+	
+	// A raw inflate stream, started at a checkpoint instead of the beginning
+	class Inflater
+	{
+		public:
+			Inflater( std::string_view theData, const Checkpoint& checkpoint )
+			   : data( theData ),
+			     in( checkpoint.in ),
+			     finished( false )
+			{
+				stream.zalloc = Z_NULL;
+				stream.zfree = Z_NULL;
+				stream.opaque = Z_NULL;
+				stream.next_in = Z_NULL;
+				stream.avail_in = 0;
+				
+				if ( in > data.length() or ( checkpoint.bits > 0 and in == 0 ) )
+				{
+					throw std::runtime_error( "Checkpoint is outside the deflated data." );
+				}
+				
+				if ( inflateInit2( &stream, -15 ) != Z_OK )
+				{
+					throw std::runtime_error( "Failed to init zlib inflate." );
+				}
+				
+				// The bits of the block that are in the byte before, then
+				// whatever it could refer back to
+				int ret = Z_OK;
+				if ( checkpoint.bits > 0 )
+				{
+					ret = inflatePrime( &stream, checkpoint.bits, static_cast< unsigned char >( data[ in - 1 ] ) >> ( 8 - checkpoint.bits ) );
+				}
+				if ( ret == Z_OK and !checkpoint.window.empty() )
+				{
+					ret = inflateSetDictionary( &stream, reinterpret_cast< const Bytef* >( checkpoint.window.data() ), checkpoint.window.length() );
+				}
+				
+				if ( ret != Z_OK )
+				{
+					inflateEnd( &stream );
+					throw std::runtime_error( "Couldn't start inflating from checkpoint: " + util::toString( ret ) );
+				}
+			}
+			
+			~Inflater()
+			{
+				inflateEnd( &stream );
+			}
+			
+			Inflater( const Inflater& other ) = delete;
+			Inflater& operator = ( const Inflater& other ) = delete;
+			
+			// Fills out, unless the stream ends first; gives back how much it got
+			std::size_t inflateInto( char* out, std::size_t size, Counters* counters )
+			{
+				std::size_t done = 0;
+				while ( done < size and !finished )
+				{
+					done += step( out + done, size - done, Z_NO_FLUSH, counters );
+				}
+				
+				return done;
+			}
+			
+			// Stops early at the end of a block, so isAtBlockEnd() can be checked
+			std::size_t inflateBlock( char* out, std::size_t size, Counters* counters )
+			{
+				return finished ? 0 : step( out, size, Z_BLOCK, counters );
+			}
+			
+			bool isFinished() const
+			{
+				return finished;
+			}
+			
+			// See inflate() in zlib.h for what data_type has in it after Z_BLOCK
+			bool isAtBlockEnd() const
+			{
+				return !finished and ( stream.data_type & 128 ) and !( stream.data_type & 64 );
+			}
+			
+			int getBits() const
+			{
+				return stream.data_type & 7;
+			}
+			
+			sf::Uint64 getIn() const
+			{
+				return in;
+			}
+		
+		private:
+			std::string_view data;
+			sf::Uint64 in;
+			bool finished;
+			z_stream stream;
+			
+			std::size_t step( char* out, std::size_t size, int flush, Counters* counters )
+			{
+				stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( data.data() + in ) );
+				stream.avail_in = std::min< sf::Uint64 >( data.length() - in, MAX_CHUNK );
+				stream.next_out = reinterpret_cast< Bytef* >( out );
+				stream.avail_out = std::min( size, MAX_CHUNK );
+				uInt availIn = stream.avail_in;
+				uInt availOut = stream.avail_out;
+				
+				int ret;
+				{
+					PhaseTimer timer( counters, Counters::InflateTime );
+					ret = inflate( &stream, flush );
+				}
+				switch ( ret )
+				{
+					case Z_OK:
+						break;
+					
+					case Z_STREAM_END:
+						finished = true;
+						break;
+					
+					case Z_BUF_ERROR:
+						throw std::runtime_error( "Deflated data is shorter than it should be." );
+					
+					default:
+						throw std::runtime_error( "Error with inflate: " + util::toString( ret ) );
+				}
+				
+				in += availIn - stream.avail_in;
+				return availOut - stream.avail_out;
+			}
+	};
+	
+	const Checkpoint& findCheckpoint( const Checkpoints& checkpoints, sf::Uint64 offset )
+	{
+		static const Checkpoint start;
+		
+		auto it = std::upper_bound( checkpoints.begin(), checkpoints.end(), offset, []( sf::Uint64 offset, const Checkpoint& checkpoint )
+		{
+			return offset < checkpoint.out;
+		} );
+		
+		return ( it == checkpoints.begin() ) ? start : ( * ( it - 1 ) );
+	}
+}
+
+namespace zip
+{
+	namespace priv
+	{
+		Checkpoints buildCheckpoints( std::string_view data, sf::Uint64 spacing, Counters* counters )
+		{
+			Checkpoints checkpoints( 1 );
+			Inflater inflater( data, checkpoints[ 0 ] );
+			
+			// Output goes round and round this, since only the last 32 KB
+			// is ever needed
+			std::string window( WINDOW_SIZE, '\0' );
+			std::size_t pos = 0;
+			sf::Uint64 out = 0;
+			while ( !inflater.isFinished() )
+			{
+				std::size_t got = inflater.inflateBlock( &window[ pos ], WINDOW_SIZE - pos, counters );
+				pos = ( pos + got ) % WINDOW_SIZE;
+				out += got;
+				
+				if ( inflater.isAtBlockEnd() and out - checkpoints.back().out >= spacing )
+				{
+					Checkpoint checkpoint;
+					checkpoint.in = inflater.getIn();
+					checkpoint.out = out;
+					checkpoint.bits = inflater.getBits();
+					checkpoint.window = ( out < WINDOW_SIZE ) ? window.substr( 0, pos ) : window.substr( pos ) + window.substr( 0, pos );
+					checkpoints.push_back( std::move( checkpoint ) );
+				}
+			}
+			
+			print( "Built " << checkpoints.size() << " checkpoints for " << out << " bytes" );
+			return checkpoints;
+		}
+		
+		std::string inflateRange( std::string_view data, const Checkpoints& checkpoints, sf::Uint64 offset, std::size_t length, Counters* counters )
+		{
+			const Checkpoint& checkpoint = findCheckpoint( checkpoints, offset );
+			Inflater inflater( data, checkpoint );
+			
+			std::string skipped( std::min< sf::Uint64 >( offset - checkpoint.out, WINDOW_SIZE ), '\0' );
+			for ( sf::Uint64 left = offset - checkpoint.out; left > 0 and !inflater.isFinished(); )
+			{
+				left -= inflater.inflateInto( &skipped[ 0 ], std::min< sf::Uint64 >( left, skipped.length() ), counters );
+			}
+			
+			std::string contents( length, '\0' );
+			contents.resize( inflater.inflateInto( &contents[ 0 ], length, counters ) );
+			return contents;
+		}
+		
+		std::string inflateParallel( std::string_view data, sf::Uint64 size, const Checkpoints& checkpoints, unsigned int threads, sf::Uint32* crc, Counters* counters )
+		{
+			checkInflatedSize( data, size );
+			std::string contents( size, '\0' );
+			std::vector< sf::Uint32 > crcs( checkpoints.size(), 0 );
+			parallelFor( checkpoints.size(), threads, [ & ]( std::size_t i )
+			{
+				sf::Uint64 begin = checkpoints[ i ].out;
+				sf::Uint64 end = ( i + 1 < checkpoints.size() ) ? checkpoints[ i + 1 ].out : size;
+				if ( begin > end or end > size )
+				{
+					throw std::runtime_error( "Checkpoints don't fit the inflated size." );
+				}
+				
+				Inflater inflater( data, checkpoints[ i ] );
+				if ( inflater.inflateInto( &contents[ begin ], end - begin, counters ) != end - begin )
+				{
+					throw std::runtime_error( "Deflated data is shorter than it should be." );
+				}
+				
+				// The last stretch has to be the end of the stream, too
+				char extra;
+				if ( i + 1 == checkpoints.size() and inflater.inflateInto( &extra, 1, counters ) != 0 )
+				{
+					throw std::runtime_error( "Deflated data is longer than it should be." );
+				}
+				
+				if ( crc != NULL )
+				{
+					PhaseTimer timer( counters, Counters::CrcTime );
+					crcs[ i ] = getCrc32( std::string_view( contents ).substr( begin, end - begin ) );
+				}
+			} );
+			
+			if ( crc != NULL )
+			{
+				for ( std::size_t i = 0; i < checkpoints.size(); ++i )
+				{
+					sf::Uint64 end = ( i + 1 < checkpoints.size() ) ? checkpoints[ i + 1 ].out : size;
+					* crc = crc32_combine( * crc, crcs[ i ], end - checkpoints[ i ].out );
+				}
+			}
+			
+			return contents;
+		}
+		
+		std::string makeCheckpointExtra( const Checkpoints& checkpoints )
+		{
+			// The one at 0 is a given
+			std::vector< const Checkpoint* > saved;
+			for ( std::size_t i = 0; i < checkpoints.size(); ++i )
+			{
+				if ( checkpoints[ i ].out > 0 and checkpoints[ i ].bits == 0 and checkpoints[ i ].window.empty() )
+				{
+					saved.push_back( &checkpoints[ i ] );
+				}
+			}
+			
+			while ( saved.size() * 16 > MAX_EXTRA )
+			{
+				for ( std::size_t i = 0; i < saved.size() / 2; ++i )
+				{
+					saved[ i ] = saved[ i * 2 + 1 ];
+				}
+				saved.resize( saved.size() / 2 );
+			}
+			
+			if ( saved.empty() )
+			{
+				return "";
+			}
+			
+			std::ostringstream ss( std::ostringstream::out | std::ostringstream::binary );
+			write< sf::Uint16 >( ss, checkpointExtraId );
+			write< sf::Uint16 >( ss, saved.size() * 16 );
+			for ( std::size_t i = 0; i < saved.size(); ++i )
+			{
+				write< sf::Uint64 >( ss, saved[ i ]->in );
+				write< sf::Uint64 >( ss, saved[ i ]->out );
+			}
+			
+			return ss.str();
+		}
+		
+		Checkpoints readCheckpointExtra( std::string extra, sf::Uint64 sizeCompressed, sf::Uint64 sizeNormal )
+		{
+			std::string field;
+			if ( !takeExtraField( extra, checkpointExtraId, field ) )
+			{
+				return Checkpoints();
+			}
+			
+			MemoryBuffer buffer( field.data(), field.length() );
+			std::istream ss( &buffer );
+			Checkpoints checkpoints( 1 );
+			for ( std::size_t i = 0; i + 16 <= field.length(); i += 16 )
+			{
+				Checkpoint checkpoint;
+				checkpoint.in = read< sf::Uint64 >( ss );
+				checkpoint.out = read< sf::Uint64 >( ss );
+				
+				// Someone else's field with the same id, or just broken
+				if ( checkpoint.in <= checkpoints.back().in or checkpoint.in > sizeCompressed or
+				     checkpoint.out <= checkpoints.back().out or checkpoint.out > sizeNormal )
+				{
+					print( "Ignoring bad checkpoints" );
+					return Checkpoints();
+				}
+				checkpoints.push_back( checkpoint );
+			}
+			
+			return checkpoints;
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef ZIP_CHECKPOINTS_HPP
+#define ZIP_CHECKPOINTS_HPP
+
+#include <SFML/Config.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "zip/Statistics.hpp"
+
+namespace zip
+{
+	namespace priv
+	{
+		// A place part way through a deflate stream that inflating can start
+		// from, so getting at the end of a big entry doesn't mean inflating
+		// everything before it (same idea as zlib's examples/zran.c).
+		struct Checkpoint
+		{
+			sf::Uint64 in = 0; // Where the next block starts in the deflated data
+			sf::Uint64 out = 0; // And where that is in the inflated data
+			int bits = 0; // If the block doesn't start on a byte boundary, how many bits of the byte before in it starts with
+			std::string window; // The (up to) 32 KB inflated right before out, or empty if the deflater was flushed there
+		};
+		
+		// Always sorted, and starting with one at 0
+		typedef std::vector< Checkpoint > Checkpoints;
+		
+		// What checkpoints are saved under in an entry's extra field. Not
+		// registered with anyone, but other readers skip fields they don't
+		// know.
+		const sf::Uint16 checkpointExtraId = 0x4b43;
+		
+		// Goes through the whole of data once, keeping a checkpoint at the
+		// first block boundary after every spacing bytes of output.
+		Checkpoints buildCheckpoints( std::string_view data, sf::Uint64 spacing, Counters* counters = NULL );
+		
+		// Inflates length bytes from offset (fewer if the data ends first),
+		// starting from the last checkpoint at or before offset
+		std::string inflateRange( std::string_view data, const Checkpoints& checkpoints, sf::Uint64 offset, std::size_t length, Counters* counters = NULL );
+		
+		// Same as getInflated(), but the stretches between checkpoints are
+		// inflated (and their CRCs worked out) on different threads
+		std::string inflateParallel( std::string_view data, sf::Uint64 size, const Checkpoints& checkpoints, unsigned int threads, sf::Uint32* crc = NULL, Counters* counters = NULL );
+		
+		// Only for checkpoints without windows, since those won't fit. If
+		// there are too many, every other one is dropped until they do.
+		std::string makeCheckpointExtra( const Checkpoints& checkpoints );
+		
+		// Empty if extra doesn't have the field, or it doesn't make sense for
+		// an entry of these sizes
+		Checkpoints readCheckpointExtra( std::string extra, sf::Uint64 sizeCompressed, sf::Uint64 sizeNormal );
+	}
+}
+
+#endif // ZIP_CHECKPOINTS_HPP
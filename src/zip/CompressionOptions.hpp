@@ -0,0 +1,49 @@
+#ifndef ZIP_COMPRESSIONOPTIONS_HPP
+#define ZIP_COMPRESSIONOPTIONS_HPP
+
+#include <SFML/Config.hpp>
+
+namespace zip
+{
+	// How an entry gets compressed when saved. The numbers are zlib's
+	// (see deflateInit2), so they can be passed straight through.
+	struct CompressionOptions
+	{
+		enum Method : sf::Uint16
+		{
+			Stored = 0,
+			Deflated = 8,
+		};
+		
+		enum Strategy : int
+		{
+			Default = 0,
+			Filtered = 1,
+			HuffmanOnly = 2,
+			Rle = 3,
+			Fixed = 4,
+		};
+		
+		Method method = Deflated; // Falls back to Stored if deflating doesn't make it any smaller
+		int level = -1; // 0 to 9, or -1 for zlib's default (currently 6)
+		int memLevel = 8; // 1 to 9
+		int windowBits = 15; // 9 to 15
+		Strategy strategy = Default;
+		
+		// Look at the start of the data first (known formats like JPEG or
+		// zip, how random it is), and store it straight away if deflating
+		// doesn't look like it'll help. Saves a whole deflate pass on
+		// things that are already compressed.
+		bool adaptive = false;
+		
+		// Flush the deflater after about every this many bytes, and save
+		// where in the entry's extra field. Entry::read() can then start at
+		// the closest one instead of the beginning, and the entry can be
+		// inflated on several threads. Each flush costs a few bytes and the
+		// history deflate had built up, so keep it to big entries and a
+		// megabyte or more. 0 turns it off.
+		sf::Uint64 checkpointSpacing = 0;
+	};
+}
+
+#endif // ZIP_COMPRESSIONOPTIONS_HPP
@@ -0,0 +1,184 @@
+#include "zip/Crc32.hpp"
+
+#if ( defined( __GNUC__ ) or defined( __clang__ ) ) and ( defined( __x86_64__ ) or defined( __i386__ ) )
+	#include <immintrin.h>
+	
+	#define ZIP_CRC32_CLMUL
+#endif
+
+namespace
+{
+	typedef sf::Uint32 ( * CrcFunction )( sf::Uint32 crc, const unsigned char* data, std::size_t size );
+	
+	struct Tables
+	{
+		sf::Uint32 table[ 8 ][ 256 ];
+		
+		Tables()
+		{
+			for ( sf::Uint32 i = 0; i < 256; ++i )
+			{
+				sf::Uint32 crc = i;
+				for ( int bit = 0; bit < 8; ++bit )
+				{
+					crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xEDB88320 : ( crc >> 1 );
+				}
+				table[ 0 ][ i ] = crc;
+			}
+			
+			// table[ n ][ i ] is i followed by n zero bytes
+			for ( int n = 1; n < 8; ++n )
+			{
+				for ( sf::Uint32 i = 0; i < 256; ++i )
+				{
+					table[ n ][ i ] = ( table[ n - 1 ][ i ] >> 8 ) ^ table[ 0 ][ table[ n - 1 ][ i ] & 0xFF ];
+				}
+			}
+		}
+	};
+	
+	sf::Uint32 getUint32( const unsigned char* data )
+	{
+		return data[ 0 ] | ( data[ 1 ] << 8 ) | ( data[ 2 ] << 16 ) | ( static_cast< sf::Uint32 >( data[ 3 ] ) << 24 );
+	}
+	
+	// Eight bytes per step instead of one, with a table for each
+	sf::Uint32 crcSliced( sf::Uint32 crc, const unsigned char* data, std::size_t size )
+	{
+		static const Tables tables;
+		const sf::Uint32 ( &t )[ 8 ][ 256 ] = tables.table;
+		
+		for ( ; size >= 8; data += 8, size -= 8 )
+		{
+			sf::Uint32 one = crc ^ getUint32( data );
+			sf::Uint32 two = getUint32( data + 4 );
+			crc = t[ 7 ][ one & 0xFF ] ^ t[ 6 ][ ( one >> 8 ) & 0xFF ] ^ t[ 5 ][ ( one >> 16 ) & 0xFF ] ^ t[ 4 ][ one >> 24 ] ^
+			      t[ 3 ][ two & 0xFF ] ^ t[ 2 ][ ( two >> 8 ) & 0xFF ] ^ t[ 1 ][ ( two >> 16 ) & 0xFF ] ^ t[ 0 ][ two >> 24 ];
+		}
+		
+		for ( ; size > 0; ++data, --size )
+		{
+			crc = ( crc >> 8 ) ^ t[ 0 ][ ( crc ^ ( * data ) ) & 0xFF ];
+		}
+		
+		return crc;
+	}
+	
+	#ifdef ZIP_CRC32_CLMUL
+	// Folds 64 bytes at a time with carry-less multiplies, then Barrett
+	// reduces what's left. See Intel's "Fast CRC Computation for Generic
+	// Polynomials Using PCLMULQDQ Instruction" for where the constants come
+	// from. Needs size >= 64 and a multiple of 16.
+	__attribute__(( target( "pclmul,sse4.1" ) ))
+	sf::Uint32 crcFolded( sf::Uint32 crc, const unsigned char* data, std::size_t size )
+	{
+		alignas( 16 ) static const sf::Uint64 k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+		alignas( 16 ) static const sf::Uint64 k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+		alignas( 16 ) static const sf::Uint64 k5k0[] = { 0x0163cd6124, 0x0000000000 };
+		alignas( 16 ) static const sf::Uint64 poly[] = { 0x01db710641, 0x01f7011641 };
+		
+		__m128i x1 = _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x00 ) );
+		__m128i x2 = _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x10 ) );
+		__m128i x3 = _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x20 ) );
+		__m128i x4 = _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x30 ) );
+		x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( crc ) );
+		data += 64;
+		size -= 64;
+		
+		__m128i k = _mm_load_si128( reinterpret_cast< const __m128i* >( k1k2 ) );
+		for ( ; size >= 64; data += 64, size -= 64 )
+		{
+			__m128i x5 = _mm_clmulepi64_si128( x1, k, 0x00 );
+			__m128i x6 = _mm_clmulepi64_si128( x2, k, 0x00 );
+			__m128i x7 = _mm_clmulepi64_si128( x3, k, 0x00 );
+			__m128i x8 = _mm_clmulepi64_si128( x4, k, 0x00 );
+			
+			x1 = _mm_clmulepi64_si128( x1, k, 0x11 );
+			x2 = _mm_clmulepi64_si128( x2, k, 0x11 );
+			x3 = _mm_clmulepi64_si128( x3, k, 0x11 );
+			x4 = _mm_clmulepi64_si128( x4, k, 0x11 );
+			
+			x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x00 ) ) );
+			x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x10 ) ) );
+			x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x20 ) ) );
+			x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( reinterpret_cast< const __m128i* >( data + 0x30 ) ) );
+		}
+		
+		// Down to 128 bits, then whatever 16 byte blocks are left
+		k = _mm_load_si128( reinterpret_cast< const __m128i* >( k3k4 ) );
+		__m128i rest[] = { x2, x3, x4 };
+		for ( __m128i x : rest )
+		{
+			__m128i x5 = _mm_clmulepi64_si128( x1, k, 0x00 );
+			x1 = _mm_clmulepi64_si128( x1, k, 0x11 );
+			x1 = _mm_xor_si128( _mm_xor_si128( x1, x ), x5 );
+		}
+		for ( ; size >= 16; data += 16, size -= 16 )
+		{
+			__m128i x5 = _mm_clmulepi64_si128( x1, k, 0x00 );
+			x1 = _mm_clmulepi64_si128( x1, k, 0x11 );
+			x1 = _mm_xor_si128( _mm_xor_si128( x1, _mm_loadu_si128( reinterpret_cast< const __m128i* >( data ) ) ), x5 );
+		}
+		
+		// 128 bits to 64
+		__m128i mask = _mm_setr_epi32( ~0, 0, ~0, 0 );
+		x2 = _mm_clmulepi64_si128( x1, k, 0x10 );
+		x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+		
+		k = _mm_loadl_epi64( reinterpret_cast< const __m128i* >( k5k0 ) );
+		x2 = _mm_srli_si128( x1, 4 );
+		x1 = _mm_clmulepi64_si128( _mm_and_si128( x1, mask ), k, 0x00 );
+		x1 = _mm_xor_si128( x1, x2 );
+		
+		// Barrett reduction down to 32
+		k = _mm_load_si128( reinterpret_cast< const __m128i* >( poly ) );
+		x2 = _mm_clmulepi64_si128( _mm_and_si128( x1, mask ), k, 0x10 );
+		x2 = _mm_clmulepi64_si128( _mm_and_si128( x2, mask ), k, 0x00 );
+		x1 = _mm_xor_si128( x1, x2 );
+		
+		return _mm_extract_epi32( x1, 1 );
+	}
+	#endif
+	
+	CrcFunction getFolded()
+	{
+		#ifdef ZIP_CRC32_CLMUL
+			__builtin_cpu_init();
+			if ( __builtin_cpu_supports( "pclmul" ) and __builtin_cpu_supports( "sse4.1" ) )
+			{
+				return &crcFolded;
+			}
+		#endif
+		
+		return NULL;
+	}
+}
+
+namespace zip
+{
+	namespace priv
+	{
+		sf::Uint32 updateCrc32( sf::Uint32 crc, const char* data, std::size_t size )
+		{
+			static const CrcFunction folded = getFolded();
+			
+			const unsigned char* bytes = reinterpret_cast< const unsigned char* >( data );
+			crc = ~crc;
+			if ( folded != NULL and size >= 64 )
+			{
+				std::size_t length = size & ~static_cast< std::size_t >( 15 );
+				crc = folded( crc, bytes, length );
+				bytes += length;
+				size -= length;
+			}
+			crc = crcSliced( crc, bytes, size );
+			
+			return ~crc;
+		}
+		
+		sf::Uint32 getCrc32( std::string_view data )
+		{
+			return updateCrc32( 0, data.data(), data.length() );
+		}
+	}
+}
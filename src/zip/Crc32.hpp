@@ -0,0 +1,20 @@
+#ifndef ZIP_CRC32_HPP
+#define ZIP_CRC32_HPP
+
+#include <cstddef>
+#include <SFML/Config.hpp>
+#include <string_view>
+
+namespace zip
+{
+	namespace priv
+	{
+		// The CRC-32 zip uses (same as zlib's crc32()). Carry-less multiply
+		// folding on CPUs that have it, checked once at startup, and
+		// slicing-by-8 everywhere else.
+		sf::Uint32 updateCrc32( sf::Uint32 crc, const char* data, std::size_t size );
+		sf::Uint32 getCrc32( std::string_view data );
+	}
+}
+
+#endif // ZIP_CRC32_HPP
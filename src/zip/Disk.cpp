@@ -0,0 +1,565 @@
+#include "zip/Disk.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#include <direct.h>
+	#include <fcntl.h>
+	#include <io.h>
+	#include <sys/stat.h>
+	#include <sys/utime.h>
+	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	
+	#ifdef __linux__
+		#include <sys/sendfile.h>
+	#endif
+#endif
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+namespace
+{
+	constexpr std::size_t MAX_CHUNK = 1 << 30; // What one read()/write() can be trusted with everywhere
+	constexpr sf::Uint64 MIN_MAP_SIZE = 1 << 20; // Below this, mapping costs more than the copy it saves
+	
+	std::runtime_error makeError( const std::string& what, const std::string& filename )
+	{
+		return std::runtime_error( what + " " + filename + ": " + std::strerror( errno ) );
+	}
+	
+	void makeDirectory( const std::string& path, bool followLinks )
+	{
+		#ifdef _WIN32
+			int ret = _mkdir( path.c_str() );
+		#else
+			int ret = mkdir( path.c_str(), 0777 );
+		#endif
+		if ( ret == 0 or errno != EEXIST )
+		{
+			if ( ret != 0 )
+			{
+				throw makeError( "Couldn't make directory", path );
+			}
+			return;
+		}
+		
+		// Fine, as long as it's a directory that's there
+		struct stat info;
+		#ifdef _WIN32
+			int found = stat( path.c_str(), &info );
+			( void ) followLinks;
+		#else
+			int found = followLinks ? stat( path.c_str(), &info ) : lstat( path.c_str(), &info );
+		#endif
+		if ( found != 0 or !S_ISDIR( info.st_mode ) )
+		{
+			throw std::runtime_error( "Something that isn't a directory is in the way at " + path + "." );
+		}
+	}
+	
+	void listDirectory( const std::string& directory, const std::string& prefix, std::vector< std::string >& files, std::vector< std::string >& directories )
+	{
+		std::vector< std::string > subdirectories;
+		
+		#ifdef _WIN32
+			WIN32_FIND_DATAA found;
+			HANDLE handle = FindFirstFileA( ( directory + "\\*" ).c_str(), &found );
+			if ( handle == INVALID_HANDLE_VALUE )
+			{
+				throw std::runtime_error( "Couldn't list directory " + directory + "." );
+			}
+			
+			do
+			{
+				std::string name = found.cFileName;
+				if ( name == "." or name == ".." )
+				{
+					continue;
+				}
+				else if ( found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
+				{
+					// Junctions could go round in circles
+					if ( !( found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT ) )
+					{
+						subdirectories.push_back( name );
+					}
+				}
+				else
+				{
+					files.push_back( prefix + name );
+				}
+			}
+			while ( FindNextFileA( handle, &found ) );
+			FindClose( handle );
+		#else
+			DIR* dir = opendir( directory.c_str() );
+			if ( dir == NULL )
+			{
+				throw makeError( "Couldn't list directory", directory );
+			}
+			
+			while ( struct dirent* found = readdir( dir ) )
+			{
+				std::string name = found->d_name;
+				if ( name == "." or name == ".." )
+				{
+					continue;
+				}
+				
+				// Most filesystems say what it is straight away
+				unsigned char type = found->d_type;
+				if ( type == DT_UNKNOWN or type == DT_LNK )
+				{
+					struct stat info;
+					if ( stat( ( directory + "/" + name ).c_str(), &info ) != 0 )
+					{
+						print( "Skipping " << name << ", probably a broken link" );
+						continue;
+					}
+					
+					// Links to directories could go round in circles
+					if ( S_ISREG( info.st_mode ) )
+					{
+						type = DT_REG;
+					}
+					else if ( S_ISDIR( info.st_mode ) and type == DT_UNKNOWN )
+					{
+						type = DT_DIR;
+					}
+					else
+					{
+						continue;
+					}
+				}
+				
+				if ( type == DT_DIR )
+				{
+					subdirectories.push_back( name );
+				}
+				else if ( type == DT_REG )
+				{
+					files.push_back( prefix + name );
+				}
+			}
+			closedir( dir );
+		#endif
+		
+		for ( std::size_t i = 0; i < subdirectories.size(); ++i )
+		{
+			directories.push_back( prefix + subdirectories[ i ] );
+			listDirectory( directory + "/" + subdirectories[ i ], prefix + subdirectories[ i ] + "/", files, directories );
+		}
+	}
+}
+
+namespace zip
+{
+	namespace priv
+	{
+		bool FileIdentity::operator == ( const FileIdentity& other ) const
+		{
+			return device == other.device and inode == other.inode and size == other.size and modified == other.modified and changed == other.changed;
+		}
+		
+		bool FileIdentity::operator != ( const FileIdentity& other ) const
+		{
+			return !( * this == other );
+		}
+		
+		bool getFileIdentity( const std::string& filename, FileIdentity& identity )
+		{
+			#ifdef _WIN32
+				struct _stat64 info;
+				if ( _stat64( filename.c_str(), &info ) != 0 )
+				{
+					return false;
+				}
+			#else
+				struct stat info;
+				if ( stat( filename.c_str(), &info ) != 0 )
+				{
+					return false;
+				}
+			#endif
+			
+			identity.device = info.st_dev;
+			identity.inode = info.st_ino;
+			identity.size = info.st_size;
+			#ifdef __linux__
+				identity.modified = static_cast< sf::Int64 >( info.st_mtim.tv_sec ) * 1000000000 + info.st_mtim.tv_nsec;
+				identity.changed = static_cast< sf::Int64 >( info.st_ctim.tv_sec ) * 1000000000 + info.st_ctim.tv_nsec;
+			#else
+				identity.modified = info.st_mtime;
+				identity.changed = info.st_ctime;
+			#endif
+			return true;
+		}
+		
+		void makeDirectories( const std::string& path )
+		{
+			// Each parent first, skipping the empty bit before a leading slash
+			for ( std::size_t i = path.find_first_of( "/\\", 1 ); i != std::string::npos; i = path.find_first_of( "/\\", i + 1 ) )
+			{
+				if ( path[ i - 1 ] != '/' and path[ i - 1 ] != '\\' and path[ i - 1 ] != ':' )
+				{
+					::makeDirectory( path.substr( 0, i ), true );
+				}
+			}
+			
+			if ( !path.empty() and path.back() != '/' and path.back() != '\\' )
+			{
+				::makeDirectory( path, true );
+			}
+		}
+		
+		void makeDirectory( const std::string& path )
+		{
+			::makeDirectory( path, false );
+		}
+		
+		bool replaceFile( const std::string& from, const std::string& to )
+		{
+			#ifdef _WIN32
+				// rename() won't replace anything here
+				return MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+			#else
+				return std::rename( from.c_str(), to.c_str() ) == 0;
+			#endif
+		}
+		
+		std::string resolveLinks( const std::string& filename )
+		{
+			std::string path = filename;
+			#ifndef _WIN32
+				// Same limit as the kernel, in case of a loop
+				for ( int i = 0; i < 40; ++i )
+				{
+					struct stat info;
+					if ( lstat( path.c_str(), &info ) != 0 or !S_ISLNK( info.st_mode ) )
+					{
+						break;
+					}
+					
+					std::string target( info.st_size > 0 ? info.st_size + 1 : PATH_MAX, '\0' );
+					ssize_t length = readlink( path.c_str(), &target[ 0 ], target.length() );
+					if ( length < 0 or static_cast< std::size_t >( length ) >= target.length() )
+					{
+						break;
+					}
+					target.resize( length );
+					
+					// Relative ones are from the link's directory
+					std::size_t slash = path.rfind( '/' );
+					path = ( target[ 0 ] == '/' or slash == std::string::npos ) ? target : path.substr( 0, slash + 1 ) + target;
+				}
+			#endif
+			
+			return path;
+		}
+		
+		std::string makeTemporaryFile( const std::string& filename )
+		{
+			std::random_device random;
+			for ( int i = 0; i < 100; ++i )
+			{
+				std::string name = filename + "." + std::to_string( random() ) + ".part";
+				#ifdef _WIN32
+					int file = _open( name.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE );
+					if ( file >= 0 )
+					{
+						_close( file );
+						return name;
+					}
+				#else
+					int file = open( name.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666 );
+					if ( file >= 0 )
+					{
+						struct stat info;
+						if ( stat( filename.c_str(), &info ) == 0 )
+						{
+							fchmod( file, info.st_mode & 07777 );
+						}
+						::close( file );
+						return name;
+					}
+				#endif
+				
+				if ( errno != EEXIST )
+				{
+					print( "Couldn't make a temporary file for " << filename << ": " << std::strerror( errno ) );
+					break;
+				}
+			}
+			
+			return "";
+		}
+		
+		void listDirectory( const std::string& directory, std::vector< std::string >& files, std::vector< std::string >& directories )
+		{
+			::listDirectory( directory, "", files, directories );
+		}
+		
+		InputFile::InputFile( const std::string& theFilename )
+		   : filename( theFilename ),
+		     size( 0 ),
+		     modified( 0 )
+		     #ifndef _WIN32
+		     , fd( -1 ),
+		     view( NULL )
+		     #endif
+		{
+			#ifdef _WIN32
+				struct _stat64 info;
+				if ( _stat64( filename.c_str(), &info ) != 0 )
+				{
+					throw makeError( "Couldn't open", filename );
+				}
+				
+				file.open( filename.c_str(), std::fstream::in | std::fstream::binary );
+				if ( !file )
+				{
+					throw makeError( "Couldn't open", filename );
+				}
+			#else
+				fd = ::open( filename.c_str(), O_RDONLY | O_CLOEXEC );
+				struct stat info;
+				if ( fd == -1 or fstat( fd, &info ) != 0 )
+				{
+					throw makeError( "Couldn't open", filename );
+				}
+			#endif
+			
+			size = info.st_size;
+			modified = info.st_mtime;
+		}
+		
+		InputFile::~InputFile()
+		{
+			#ifndef _WIN32
+				if ( view != NULL )
+				{
+					munmap( view, size );
+				}
+				if ( fd != -1 )
+				{
+					::close( fd );
+				}
+			#endif
+		}
+		
+		std::string_view InputFile::read( std::string& buffer )
+		{
+			#ifdef _WIN32
+				buffer.resize( size );
+				file.read( &buffer[ 0 ], size );
+				if ( static_cast< sf::Uint64 >( file.gcount() ) != size )
+				{
+					throw makeError( "Couldn't read", filename );
+				}
+			#else
+				if ( size >= MIN_MAP_SIZE )
+				{
+					view = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+					if ( view != MAP_FAILED )
+					{
+						madvise( view, size, MADV_SEQUENTIAL );
+						return std::string_view( static_cast< const char* >( view ), size );
+					}
+					view = NULL;
+				}
+				
+				buffer.resize( size );
+				for ( sf::Uint64 done = 0; done < size; )
+				{
+					ssize_t got = ::read( fd, &buffer[ done ], std::min< sf::Uint64 >( size - done, MAX_CHUNK ) );
+					if ( got < 0 and errno == EINTR )
+					{
+						continue;
+					}
+					else if ( got < 0 )
+					{
+						throw makeError( "Couldn't read", filename );
+					}
+					else if ( got == 0 )
+					{
+						// Someone else cut it short while we were reading
+						buffer.resize( done );
+						break;
+					}
+					done += got;
+				}
+			#endif
+			
+			return buffer;
+		}
+		
+		std::time_t InputFile::getModified() const
+		{
+			return modified;
+		}
+		
+		OutputFile::OutputFile( const std::string& theFilename )
+		   : filename( theFilename )
+		{
+			#ifdef _WIN32
+				file.open( filename.c_str(), std::fstream::out | std::fstream::trunc | std::fstream::binary );
+				if ( !file )
+				{
+					throw makeError( "Couldn't open", filename );
+				}
+			#else
+				// A link that's already there gets replaced, rather than
+				// whatever it points at being written over
+				fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0666 );
+				if ( fd == -1 and errno == ELOOP and unlink( filename.c_str() ) == 0 )
+				{
+					fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0666 );
+				}
+				if ( fd == -1 )
+				{
+					throw makeError( "Couldn't open", filename );
+				}
+			#endif
+		}
+		
+		OutputFile::~OutputFile()
+		{
+			#ifndef _WIN32
+				if ( fd != -1 )
+				{
+					::close( fd );
+				}
+			#endif
+		}
+		
+		void OutputFile::write( std::string_view data )
+		{
+			#ifdef _WIN32
+				file.write( data.data(), data.length() );
+				if ( !file )
+				{
+					throw makeError( "Couldn't write to", filename );
+				}
+			#else
+				while ( !data.empty() )
+				{
+					ssize_t done = ::write( fd, data.data(), std::min( data.length(), MAX_CHUNK ) );
+					if ( done < 0 and errno == EINTR )
+					{
+						continue;
+					}
+					else if ( done <= 0 )
+					{
+						throw makeError( "Couldn't write to", filename );
+					}
+					data.remove_prefix( done );
+				}
+			#endif
+		}
+		
+		sf::Uint64 OutputFile::copy( int in, sf::Uint64 offset, sf::Uint64 length )
+		{
+			sf::Uint64 done = 0;
+			
+			#ifdef __linux__
+				// copy_file_range() can share the blocks outright on some
+				// filesystems, but needs 5.3 to work across filesystems.
+				// sendfile() has done files to files since 2.6.33.
+				bool ranges = true;
+				while ( done < length )
+				{
+					std::size_t chunk = std::min< sf::Uint64 >( length - done, MAX_CHUNK );
+					ssize_t got;
+					if ( ranges )
+					{
+						loff_t pos = offset + done;
+						got = copy_file_range( in, &pos, fd, NULL, chunk, 0 );
+					}
+					else
+					{
+						off_t pos = offset + done;
+						got = sendfile( fd, in, &pos, chunk );
+					}
+					
+					if ( got > 0 )
+					{
+						done += got;
+					}
+					else if ( got < 0 and errno == EINTR )
+					{
+						continue;
+					}
+					else if ( ranges )
+					{
+						print( "copy_file_range() didn't work (" << std::strerror( errno ) << "), trying sendfile()" );
+						ranges = false;
+					}
+					else
+					{
+						print( "sendfile() didn't work either (" << std::strerror( errno ) << ")" );
+						break;
+					}
+				}
+			#else
+				( void ) in;
+				( void ) offset;
+				( void ) length;
+			#endif
+			
+			return done;
+		}
+		
+		void OutputFile::close( std::time_t modified )
+		{
+			#ifdef _WIN32
+				file.close();
+				if ( !file )
+				{
+					throw makeError( "Couldn't write to", filename );
+				}
+				
+				if ( modified != 0 )
+				{
+					struct _utimbuf times;
+					times.actime = modified;
+					times.modtime = modified;
+					_utime( filename.c_str(), &times );
+				}
+			#else
+				if ( modified != 0 )
+				{
+					struct timespec times[ 2 ];
+					times[ 0 ].tv_sec = modified;
+					times[ 0 ].tv_nsec = 0;
+					times[ 1 ] = times[ 0 ];
+					futimens( fd, times );
+				}
+				
+				int ret = ::close( fd );
+				fd = -1;
+				if ( ret != 0 )
+				{
+					throw makeError( "Couldn't write to", filename );
+				}
+			#endif
+		}
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef ZIP_DISK_HPP
+#define ZIP_DISK_HPP
+
+#include <ctime>
+#include <fstream>
+#include <SFML/Config.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zip
+{
+	namespace priv
+	{
+		// Enough to tell whether a file has been changed or replaced since
+		struct FileIdentity
+		{
+			sf::Uint64 device = 0;
+			sf::Uint64 inode = 0; // Always 0 on Windows
+			sf::Uint64 size = 0;
+			sf::Int64 modified = 0; // In nanoseconds where there are any
+			sf::Int64 changed = 0; // Catches writes that put the modification time back, too
+			
+			bool operator == ( const FileIdentity& other ) const;
+			bool operator != ( const FileIdentity& other ) const;
+		};
+		
+		bool getFileIdentity( const std::string& filename, FileIdentity& identity );
+		
+		// Makes each missing directory along path; throws std::runtime_error
+		// if one can't be made, or something that isn't a directory is
+		// already there
+		void makeDirectories( const std::string& path );
+		
+		// Just the one, and unlike makeDirectories(), a link to a directory
+		// that's already there doesn't count
+		void makeDirectory( const std::string& path );
+		
+		// Moves from over to, replacing anything there (as one step where
+		// there's a way to)
+		bool replaceFile( const std::string& from, const std::string& to );
+		
+		// Where filename ends up after following any symlinks, even if
+		// there's nothing there yet
+		std::string resolveLinks( const std::string& filename );
+		
+		// A new, empty file next to filename that nobody else can have been
+		// given, to write its replacement to. It gets filename's permissions
+		// if that's there. Gives back its name, or an empty string if one
+		// couldn't be made.
+		std::string makeTemporaryFile( const std::string& filename );
+		
+		// Everything under directory, as paths relative to it with / between
+		// the parts, and each directory before anything in it. Symlinks to
+		// files count as files; ones to directories aren't followed.
+		void listDirectory( const std::string& directory, std::vector< std::string >& files, std::vector< std::string >& directories );
+		
+		// A file being added. Everything throws std::runtime_error on failure.
+		class InputFile
+		{
+			public:
+				InputFile( const std::string& filename );
+				~InputFile();
+				
+				InputFile( const InputFile& other ) = delete;
+				InputFile& operator = ( const InputFile& other ) = delete;
+				
+				// All of it, and valid until this is destroyed. Big files are
+				// mapped, since one copy fewer is worth the page table work
+				// then; anything else is read into buffer, reusing its memory.
+				std::string_view read( std::string& buffer );
+				
+				std::time_t getModified() const;
+			
+			private:
+				std::string filename;
+				sf::Uint64 size;
+				std::time_t modified;
+				
+				#ifdef _WIN32
+				std::fstream file;
+				#else
+				int fd;
+				void* view;
+				#endif
+		};
+		
+		// A file being extracted to. Everything throws std::runtime_error on
+		// failure.
+		class OutputFile
+		{
+			public:
+				OutputFile( const std::string& filename ); // Replaces anything already there, without following links
+				~OutputFile();
+				
+				OutputFile( const OutputFile& other ) = delete;
+				OutputFile& operator = ( const OutputFile& other ) = delete;
+				
+				void write( std::string_view data );
+				
+				// Appends length bytes from offset in the file behind in,
+				// without them going through user space. Gives back how many
+				// it managed, which is all of them unless the kernel can't do
+				// it for these two files (or anything but Linux), in which
+				// case the rest has to be written instead.
+				sf::Uint64 copy( int in, sf::Uint64 offset, sf::Uint64 length );
+				
+				// Sets the modification time, if there is one, first
+				void close( std::time_t modified = 0 );
+			
+			private:
+				std::string filename;
+				
+				#ifdef _WIN32
+				std::fstream file;
+				#else
+				int fd;
+				#endif
+		};
+	}
+}
+
+#endif // ZIP_DISK_HPP
@@ -1,5 +1,10 @@
 #include "zip/Entry.hpp"
 
+#include <algorithm>
+
+#include "zip/File.hpp"
+#include "zip/Format.hpp"
+
 namespace zip
 {
 	File* Entry::getFile()
@@ -32,20 +37,151 @@ namespace zip
 		return dir;
 	}
 	
-	std::string Entry::getName() const
+	const std::string& Entry::getName() const
+	{
+		return getNames().name;
+	}
+	
+	const std::string& Entry::getPath() const
+	{
+		return getNames().path;
+	}
+	
+	std::string_view Entry::getNameView() const
 	{
 		return name;
 	}
 	
+	std::string_view Entry::getPathView() const
+	{
+		return path;
+	}
+	
 	std::string Entry::getContents() const
 	{
-		return contents;
+		return std::string( getContentsView() );
+	}
+	
+	std::string_view Entry::getContentsView() const
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		if ( !loaded )
+		{
+			File::loadContents( * this );
+		}
+		
+		return ( mapped.data() != NULL ) ? mapped : std::string_view( contents );
+	}
+	
+	std::string Entry::read( sf::Uint64 offset, std::size_t length ) const
+	{
+		// Below this, going through it once to make checkpoints costs about
+		// the same as just loading it
+		constexpr sf::Uint64 MIN_SIZE = 4 << 20;
+		
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			if ( !loaded and compressType == priv::Compression::Deflated and ( checkpoints.size() > 1 or sizeNormal >= MIN_SIZE ) )
+			{
+				offset = std::min( offset, sizeNormal );
+				length = std::min< sf::Uint64 >( length, sizeNormal - offset );
+				
+				std::string_view raw = File::getRawContents( * this );
+				if ( checkpoints.size() <= 1 )
+				{
+					// 32 KB of window each, so no more than a few hundred
+					checkpoints = priv::buildCheckpoints( raw, std::max< sf::Uint64 >( 1 << 20, sizeNormal / 256 ), file->counters.get() );
+					for ( std::size_t i = 0; i < checkpoints.size(); ++i )
+					{
+						file->inflatedBytes += sizeof( priv::Checkpoint ) + checkpoints[ i ].window.length();
+					}
+				}
+				
+				return priv::inflateRange( raw, checkpoints, offset, length, file->counters.get() );
+			}
+		}
+		
+		std::string_view contents = getContentsView();
+		offset = std::min< sf::Uint64 >( offset, contents.length() );
+		return std::string( contents.substr( offset, length ) );
+	}
+	
+	const CompressionOptions& Entry::getCompression() const
+	{
+		return compression;
+	}
+	
+	void Entry::setCompression( const CompressionOptions& theCompression )
+	{
+		compression = theCompression;
+		dirty = true;
 	}
 	
 	Entry::Entry()
 	   : file( NULL ),
 	     parent( NULL ),
-	     dir( false )
+	     names( NULL ),
+	     dir( false ),
+	     dirty( true ),
+	     loaded( true ),
+	     headerOffset( 0 ),
+	     compressType( 0 ),
+	     sizeCompressed( 0 ),
+	     sizeNormal( 0 ),
+	     flags( 0 ),
+	     lastModTime( 0 ),
+	     lastModDate( 0 ),
+	     crc32( 0 ),
+	     verify( false )
+	{
+	}
+	
+	void Entry::reset()
+	{
+		children.clear();
+		file = NULL;
+		parent = NULL;
+		name = std::string_view();
+		path = std::string_view();
+		delete names.exchange( NULL );
+		dir = false;
+		dirty = true;
+		compression = CompressionOptions();
+		std::string().swap( contents );
+		mapped = std::string_view();
+		loaded = true;
+		archive.reset();
+		headerOffset = 0;
+		compressType = 0;
+		sizeCompressed = 0;
+		sizeNormal = 0;
+		flags = 0;
+		lastModTime = 0;
+		lastModDate = 0;
+		crc32 = 0;
+		verify = false;
+		priv::Checkpoints().swap( checkpoints );
+	}
+	
+	Entry::~Entry()
+	{
+		delete names.load();
+	}
+	
+	const Entry::Names& Entry::getNames() const
 	{
+		// Entries can be shared between threads (see ArchiveCache), so
+		// whoever loses the race just throws theirs away
+		Names* current = names.load( std::memory_order_acquire );
+		if ( current == NULL )
+		{
+			std::unique_ptr< Names > made( new Names{ std::string( name ), std::string( path ) } );
+			if ( names.compare_exchange_strong( current, made.get(), std::memory_order_acq_rel ) )
+			{
+				current = made.release();
+			}
+		}
+		
+		return ( * current );
 	}
 }
@@ -1,14 +1,26 @@
 #ifndef ZIP_ENTRY_HPP
 #define ZIP_ENTRY_HPP
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <SFML/Config.hpp>
 #include <string>
+#include <string_view>
 
+#include "zip/Checkpoints.hpp"
+#include "zip/CompressionOptions.hpp"
 #include "zip/EntryBase.hpp"
 
 namespace zip
 {
 	class File;
 	
+	namespace priv
+	{
+		class ArchiveBuffer;
+	}
+	
 	class Entry : public priv::EntryBase
 	{
 		public:
@@ -21,17 +33,75 @@ namespace zip
 			bool isFile() const;
 			bool isDirectory() const;
 			
-			std::string getName() const;
+			// Copies of what's in the File's name pool, made the first time
+			// either is asked for and kept up to date from then on. The views
+			// point straight into the pool, so they don't allocate, but only
+			// last until the entry is renamed.
+			const std::string& getName() const;
+			const std::string& getPath() const;
+			std::string_view getNameView() const;
+			std::string_view getPathView() const;
+			
+			// Both may inflate, and throw std::runtime_error, if lazily loaded.
+			// The view is valid until the entry is changed or destroyed, and
+			// for stored entries points straight into the archive.
 			std::string getContents() const;
+			std::string_view getContentsView() const;
+			
+			// Up to length bytes from offset, without inflating all of a big
+			// entry that's still in the archive: it starts at the closest
+			// checkpoint, either ones saved in the archive (see
+			// CompressionOptions::checkpointSpacing) or ones made by going
+			// through it once on the first call. Anything else is a copy out
+			// of getContentsView(). Nothing is checked against the CRC-32.
+			std::string read( sf::Uint64 offset, std::size_t length ) const;
+			
+			// Used the next time the archive is saved. Entries that were
+			// loaded keep the method they were stored with.
+			const CompressionOptions& getCompression() const;
+			void setCompression( const CompressionOptions& theCompression );
+		
+			~Entry();
 		
 		private:
+			struct Names
+			{
+				std::string name;
+				std::string path;
+			};
+			
 			Entry();
 			
+			void reset(); // Back to how the constructor left it, for reuse by File
+			const Names& getNames() const;
+			
 			File* file;
-			Entry* parent;
-			std::string name;
-			std::string contents;
+			Entry* parent; // NULL at the top level
+			std::string_view name; // The end of path
+			std::string_view path;
+			mutable std::atomic< Names* > names; // NULL until getName() or getPath()
 			bool dir;
+			bool dirty; // Changed since it was loaded, so it can't just be copied from the archive
+			CompressionOptions compression;
+			
+			mutable std::mutex mutex;
+			mutable std::string contents;
+			mutable std::string_view mapped; // Used instead of contents if it points anywhere
+			mutable bool loaded;
+			
+			// Where the data is in the archive we came from, until it is loaded,
+			// or for as long as it's clean if we're allowed to keep the archive
+			mutable std::shared_ptr< const priv::ArchiveBuffer > archive;
+			sf::Uint64 headerOffset;
+			sf::Uint16 compressType;
+			sf::Uint64 sizeCompressed;
+			sf::Uint64 sizeNormal;
+			sf::Uint16 flags;
+			sf::Uint16 lastModTime;
+			sf::Uint16 lastModDate;
+			sf::Uint32 crc32;
+			bool verify; // Check crc32 when loading
+			mutable priv::Checkpoints checkpoints; // Into the archive's data, for as long as there is one
 			
 			friend class File;
 	};
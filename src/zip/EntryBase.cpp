@@ -59,7 +59,7 @@ namespace zip
 			for ( auto it = begin(); it != currEnd; ++it )
 			{
 				Entry* entry = it->get();
-				if ( entry->getName() == tokens[ currToken ] )
+				if ( entry->getNameView() == tokens[ currToken ] )
 				{
 					if ( currToken >= tokens.size() - 1 )
 					{
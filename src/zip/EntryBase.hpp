@@ -1,7 +1,7 @@
 #ifndef ZIP_ENTRYBASE_HPP
 #define ZIP_ENTRYBASE_HPP
 
-#include <memory>
+#include <string>
 #include <vector>
 
 namespace zip
@@ -11,11 +11,41 @@ namespace zip
 	
 	namespace priv
 	{
+		// Entries are owned by File's entry blocks, so this just points at
+		// one. It keeps it->get() and ( * it )-> working like the unique_ptr
+		// children used to be held in.
+		class EntryPtr
+		{
+			public:
+				EntryPtr( Entry* theEntry )
+				   : entry( theEntry )
+				{
+				}
+				
+				Entry* get() const
+				{
+					return entry;
+				}
+				
+				Entry* operator -> () const
+				{
+					return entry;
+				}
+				
+				Entry& operator * () const
+				{
+					return ( * entry );
+				}
+			
+			private:
+				Entry* entry;
+		};
+		
 		class EntryBase
 		{
 			public:
-				typedef std::vector< std::unique_ptr< Entry > >::iterator Iterator;
-				typedef std::vector< std::unique_ptr< Entry > >::const_iterator ConstIterator;
+				typedef std::vector< EntryPtr >::iterator Iterator;
+				typedef std::vector< EntryPtr >::const_iterator ConstIterator;
 				
 				Iterator begin();
 				Iterator end();
@@ -26,7 +56,7 @@ namespace zip
 				const Entry* getEntry( const std::string& path ) const;
 				
 			protected:
-				std::vector< std::unique_ptr< Entry > > children;
+				std::vector< EntryPtr > children;
 				
 				ConstIterator getEntryIterator( const std::string& path ) const;
 				
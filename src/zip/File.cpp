@@ -1,12 +1,18 @@
 #include "zip/File.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
-#include <util/Crc32.hpp>
-#include <util/Endian.hpp>
 #include <util/String.hpp>
-#include <zlib.h>
+
+#include "zip/ArchiveBuffer.hpp"
+#include "zip/Crc32.hpp"
+#include "zip/Disk.hpp"
+#include "zip/Format.hpp"
+#include "zip/Parallel.hpp"
 
 #if false
 	#include <iostream>
@@ -16,905 +22,988 @@
 	#define print(a)
 #endif
 
-// TO DO: Organize this mess!
-// Also: Ignoring Zip64 :P
-
-// Why did they remove this? :(
-// I need a proper replacement
-// From SFML/Config.hpp
-#if defined(__m68k__) || defined(mc68000) || defined(_M_M68K) || (defined(__MIPS__) && defined(__MISPEB__)) || \
-    defined(__ppc__) || defined(__POWERPC__) || defined(_M_PPC) || defined(__sparc__) || defined(__hppa__)
+#define streamCheck( a ) if ( !ss ) { throw std::runtime_error( "Stream error (maybe too short?) at " + std::string( a ) ); }
 
-    // Big endian
-    #define SFML_ENDIAN_BIG
-
-#else
-
-    // Little endian
-    #define SFML_ENDIAN_LITTLE
-
-#endif
+using namespace zip::priv;
 
 namespace
 {
-	template< typename T >
-	T read( std::stringstream& ss )
+	// What the index uses: "a/b/c", with no empty parts
+	bool isCanonicalPath( std::string_view path )
 	{
-		T t;
-		ss.read( reinterpret_cast< char* >( &t ), sizeof( T ) );
+		return !path.empty() and path.front() != '/' and path.back() != '/' and path.find( "//" ) == std::string_view::npos;
+	}
 	
-		#ifdef SFML_ENDIAN_BIG
-		if ( sizeof( T ) > 1 )
+	std::string getCanonicalPath( std::string_view path )
+	{
+		std::string canonical;
+		canonical.reserve( path.length() );
+		for ( std::size_t i = 0; i < path.length(); ++i )
 		{
-			t = util::swapBytes( t );
+			if ( path[ i ] == '/' and ( canonical.empty() or canonical.back() == '/' ) )
+			{
+				continue;
+			}
+			canonical += path[ i ];
 		}
-		#endif
 		
-		return t;
-	}
-	template< typename T >
-	void write( std::stringstream& ss, T t )
-	{
-		#ifdef SFML_ENDIAN_BIG
-		if ( sizeof( T ) > 1 )
+		if ( !canonical.empty() and canonical.back() == '/' )
 		{
-			t = util::swapBytes( t );
+			canonical.pop_back();
 		}
-		#endif
 		
-		ss.write( reinterpret_cast< char* >( &t ), sizeof( T ) );
+		return canonical;
 	}
 	
-	std::string readStr( std::stringstream& ss, std::size_t len )
+	// Somewhere that stays inside the directory it's extracted to
+	bool isSafePath( std::string_view path )
 	{
-		std::string str;
-		for ( std::size_t i = 0; i < len; ++i )
+		#ifdef _WIN32
+		if ( path.find_first_of( "\\:" ) != std::string_view::npos )
 		{
-			char c = ss.get();
-			str += c;
+			return false;
+		}
+		#endif
+		
+		for ( std::size_t start = 0; start <= path.length(); )
+		{
+			std::size_t end = std::min( path.find( '/', start ), path.length() );
+			std::string_view part = path.substr( start, end - start );
+			if ( part.empty() or part == "." or part == ".." )
+			{
+				return false;
+			}
+			start = end + 1;
 		}
 		
-		return str;
+		return true;
 	}
 	
-	void writeStr( std::stringstream& ss, const std::string& str, std::size_t len )
+	// Directories (if wanted) come before anything in them
+	void collectFiles( const zip::priv::EntryBase& entry, std::vector< const zip::Entry* >& files, std::vector< const zip::Entry* >* directories = NULL )
 	{
-		ss.write( &str[ 0 ], len );
+		for ( auto it = entry.begin(); it != entry.end(); ++it )
+		{
+			const zip::Entry& entry = ( * it->get() );
+			if ( entry.isDirectory() )
+			{
+				if ( directories != NULL )
+				{
+					directories->push_back( &entry );
+				}
+				collectFiles( entry, files, directories );
+			}
+			else
+			{
+				files.push_back( &entry );
+			}
+		}
 	}
-	
-	template< typename T >
-	std::string readStr( std::stringstream& ss )
+}
+
+namespace zip
+{
+	bool File::loadFromFile( const std::string& filename, const LoadOptions& options )
 	{
-		T len = read< T >( ss );
-		return readStr( ss, len );
+		// Parse straight out of a read-only mapping when we can, so the
+		// archive is never copied into our own memory.
+		std::shared_ptr< priv::ArchiveBuffer > archive( new priv::ArchiveBuffer() );
+		if ( !archive->map( filename ) and !archive->read( filename ) )
+		{
+			return false;
+		}
+		
+		return load( archive, options );
 	}
 	
-	template< typename T >
-	void writeStr( std::stringstream& ss, const std::string& str )
+	bool File::loadFromMemory( const std::string& contents, const LoadOptions& options )
 	{
-		write< T >( ss, str.length() );
-		writeStr( ss, str, str.length() );
+		return loadFromMemory( contents.data(), contents.length(), options );
 	}
 	
-	template< sf::Uint16 N >
-	struct Signature
-	{
-		static const sf::Uint16 SIGNATURE;
-	};
-	template< sf::Uint16 N >
-	const sf::Uint16 Signature< N >::SIGNATURE = N;
-	
-	// 4.3.7
-	struct LocalFileHeaderBase
-	{
-		sf::Uint16 minVersion;
-		sf::Uint16 flags;
-		sf::Uint16 compressType;
-		
-		sf::Uint16 lastModTime;
-		sf::Uint16 lastModDate;
-		
-		sf::Uint32 crc32;
-		
-		sf::Uint32 sizeCompressed;
-		sf::Uint32 sizeNormal;
-		
-		std::string filename; // sf::Uint16 filenameLength
-		std::string extra; // sf::Uint16 extraLength
-	};
-	
-	struct LocalFileHeader : LocalFileHeaderBase, Signature< 0x0304 >
-	{
-	};
-	
-	// 4.3.9
-	struct DataDescriptor : Signature< 0x0708 >
-	{
-		sf::Uint32 crc32; // ?
-		
-		sf::Uint32 sizeCompressed;
-		sf::Uint32 sizeNormal;
-	};
-	
-	// 4.3.11
-	struct ArchiveExtraData : Signature< 0x0608 >
-	{
-		std::string extra; // sf::Uint32 extraLength
-	};
-	
-	// 4.3.12
-	struct CentralDirectoryStructure : LocalFileHeaderBase, Signature< 0x0102 >
-	{
-		sf::Uint16 versionMade;
-		
-		// LocalFileHeaderBase stuff here, except filename/extra
-		
-		std::string comment; // sf::Uint16 commentLength here, comment at the bottom
-		
-		sf::Uint16 diskNumStart;
-		sf::Uint16 inAttr;
-		sf::Uint32 exAttr;
-		sf::Uint32 localHeaderOffset;
-		
-		// LocalFileHeaderBase filename/extra here
-	};
-	
-	// 4.3.13
-	struct DigitalSignature : Signature< 0x0505 >
-	{
-		std::string data; // sf::Uint16 size
-	};
-	
-	// 4.3.16
-	struct EndCentralDirectoryStructure : Signature< 0x0506 >
-	{
-		sf::Uint16 diskNum;
-		sf::Uint16 diskNumStartCentralDirectory; // What is this? :P
-		
-		sf::Uint16 entryCountDisk;
-		sf::Uint16 entryCountCentral;
-		
-		sf::Uint32 centralDirSize;
-		sf::Uint32 centralDirOffset;
-		
-		std::string comment; // sf::Uint16 commentLength
-	};
-	
-	namespace Flags
+	bool File::loadFromMemory( const void* data, std::size_t size, const LoadOptions& options )
 	{
-		// 4.4.4
-		enum General : sf::Uint16
+		// Lazy entries outlive this call, so they need their own copy
+		std::shared_ptr< priv::ArchiveBuffer > archive( new priv::ArchiveBuffer() );
+		if ( options.lazy )
 		{
-			Encrypted =               1 << 0,
-			CompressionFlag1 =        1 << 1,
-			CompressionFlag2 =        1 << 2,
-			DataDescriptorPostponed = 1 << 3,
-			ReservedForDeflation =    1 << 4,
-			UsesPatchedData =         1 << 5, // ?
-			StrongEncryption =        1 << 6,
-			LanguageEncoded =         1 << 11,
-			ReservedByPkware12 =      1 << 12,
-			SomeValuesMasked =        1 << 13, // For strong encryption
-			ReservedByPkware14 =      1 << 14,
-			ReservedByPkware15 =      1 << 15,
-		};
-	}
-	
-	namespace Compression
-	{
-		// 4.4.5
-		enum CompressionMethod : sf::Uint16
-		{
-			None = 0,
-			Shrunk = 1,
-			Reduced1 = 2,
-			Reduced2 = 3,
-			Reduced3 = 4,
-			Reduced4 = 5,
-			Imploded = 6,
-			ReservedForTokenizing = 7,
-			Deflated = 8,
-			EnhancedDeflate64 = 9,
-			PkwareImploding = 10,
-			ReservedByPkware11 = 11,
-			BZip2 = 12,
-			ReservedByPkware13 = 13,
-			Lzma = 14,
-			ReservedByPkware15 = 15,
-			ReservedByPkware16 = 16,
-			ReservedByPkware17 = 17,
-			IbmTerse = 18,
-			IbmLz77 = 19,
-			WavPack = 97,
-			Ppmd = 98,
-		};
-	}
-	
-	// 4.4.7
-	const sf::Uint32 magicNumberCrc32 = 0xe320bbde;
-	
-	std::string makeSig( sf::Uint16 sig )
-	{
-		// Not sure why
-		#ifdef SFML_ENDIAN_LITTLE
-			sig = util::swapBytes( sig );
-		#endif
+			archive->assign( static_cast< const char* >( data ), size );
+		}
+		else
+		{
+			archive->borrow( static_cast< const char* >( data ), size );
+		}
 		
-		std::string str1 = "PK";
-		std::string str2( reinterpret_cast< const char* >( &sig ), 2 );
-		return str1 + str2;
+		return load( archive, options );
 	}
 	
-	std::size_t findEndCentralDir( const std::string& contents )
+	bool File::load( const std::shared_ptr< priv::ArchiveBuffer >& archive, const LoadOptions& options )
 	{
-		std::string sig = makeSig( EndCentralDirectoryStructure::SIGNATURE );
-		
-		for ( std::size_t i = contents.length(); i >= 4; --i )
+		std::vector< Entry* > entries;
+		Counters* stats = startStatistics( options.statistics );
+		inflatedBytes = 0;
+		try
 		{
-			std::string str = contents.substr( i - 3, 4 );
-			if ( str == sig )
+			EndCentralDirectoryStructure ecd;
+			std::vector< CentralDirectoryStructure > cds;
+			if ( !readDirectory( archive->getData(), archive->getSize(), ecd, cds, stats ) )
 			{
-				return i - 3;
+				print( "no end central dir" );
+				return false;
+			}
+			
+			// The central directory has everything we need to find each
+			// entry's data later, so the local headers aren't touched until
+			// the entry is actually loaded.
+			addCount( stats, Counters::Entries, cds.size() );
+			{
+				PhaseTimer timer( stats, Counters::TreeTime );
+				entries.reserve( cds.size() );
+				for ( std::size_t i = 0; i < cds.size(); ++i )
+				{
+					const CentralDirectoryStructure& cd = cds[ i ];
+					if ( cd.compressType != Compression::None and cd.compressType != Compression::Deflated )
+					{
+						throw std::runtime_error( "Unsupported compression type " + util::toString( cd.compressType ) + " for file " + cd.filename + "." );
+					}
+				
+					if ( cd.filename.empty() )
+					{
+						continue;
+					}
+					else if ( cd.filename[ cd.filename.length() - 1 ] == '/' )
+					{
+						addDirectory( cd.filename.substr( 0, cd.filename.length() - 1 ) );
+						continue;
+					}
+				
+					addFile( cd.filename, "" );
+					Entry* entry = getEntry( cd.filename );
+					entry->loaded = false;
+					entry->archive = archive;
+					entry->headerOffset = cd.localHeaderOffset;
+					entry->compressType = cd.compressType;
+					entry->sizeCompressed = cd.sizeCompressed;
+					entry->sizeNormal = cd.sizeNormal;
+					entry->flags = cd.flags;
+					entry->lastModTime = cd.lastModTime;
+					entry->lastModDate = cd.lastModDate;
+					entry->crc32 = cd.crc32;
+					entry->dirty = false;
+					entry->verify = options.verify;
+					if ( cd.compressType == Compression::Deflated )
+					{
+						entry->checkpoints = readCheckpointExtra( cd.extra, cd.sizeCompressed, cd.sizeNormal );
+					}
+					if ( cd.compressType == Compression::None )
+					{
+						entry->compression.method = CompressionOptions::Stored;
+					}
+					entries.push_back( entry );
+				}
+			}
+			
+			if ( !options.lazy )
+			{
+				// Every entry is its own deflate stream, so they can all be
+				// inflated at once.
+				loadContents( std::vector< const Entry* >( entries.begin(), entries.end() ), options.threads );
 			}
 		}
-		
-		return std::string::npos;
-	}
-	
-	EndCentralDirectoryStructure readEndCentralDir( std::stringstream& ss )
-	{
-		sf::Uint32 sig = read< sf::Uint32 >( ss );
-		
-		EndCentralDirectoryStructure ecd;
-		
-		ecd.diskNum = read< sf::Uint16 >( ss );
-		ecd.diskNumStartCentralDirectory = read< sf::Uint16 >( ss );
-		
-		ecd.entryCountDisk = read< sf::Uint16 >( ss );
-		ecd.entryCountCentral = read< sf::Uint16 >( ss );
-		
-		if ( ecd.entryCountDisk != ecd.entryCountCentral )
+		catch ( std::exception& exception )
 		{
-			throw std::runtime_error( "Don't know what to do/say." );
+			print( "Error loading zip file, exception: " << exception.what() << std::endl );
+			
+			// Don't leave anything pointing at a buffer the caller owns
+			for ( std::size_t i = 0; i < entries.size(); ++i )
+			{
+				if ( !entries[ i ]->loaded )
+				{
+					entries[ i ]->loaded = true;
+					entries[ i ]->archive.reset();
+				}
+			}
+			return false;
 		}
 		
-		ecd.centralDirSize = read< sf::Uint32 >( ss );
-		ecd.centralDirOffset = read< sf::Uint32 >( ss );
-		
-		ecd.comment = readStr< sf::Uint16 >( ss );
-		
-		return ecd;
-	}
-	
-	void writeEndCentralDir( std::stringstream& ss, EndCentralDirectoryStructure& ecd )
-	{
-		writeStr( ss, makeSig( EndCentralDirectoryStructure::SIGNATURE ), 4 );
-		
-		write< sf::Uint16 >( ss, ecd.diskNum );
-		write< sf::Uint16 >( ss, ecd.diskNumStartCentralDirectory );
-		
-		write< sf::Uint16 >( ss, ecd.entryCountDisk );
-		write< sf::Uint16 >( ss, ecd.entryCountCentral );
-		
-		write< sf::Uint32 >( ss, ecd.centralDirSize );
-		write< sf::Uint32 >( ss, ecd.centralDirOffset );
-		
-		writeStr< sf::Uint16 >( ss, ecd.comment );
+		return true;
 	}
 	
-	void readLocalFileHeaderBase( std::stringstream& ss, LocalFileHeaderBase& lfh )
+	void File::loadAll( unsigned int threads )
 	{
-		lfh.minVersion = read< sf::Uint16 >( ss );
-		lfh.flags = read< sf::Uint16 >( ss );
-		lfh.compressType = read< sf::Uint16 >( ss );
+		std::vector< const Entry* > files;
+		collectFiles( * this, files );
 		
-		lfh.lastModTime = read< sf::Uint16 >( ss );
-		lfh.lastModDate = read< sf::Uint16 >( ss );
-		
-		lfh.crc32 = read< sf::Uint32 >( ss );
+		std::vector< const Entry* > pending;
+		for ( std::size_t i = 0; i < files.size(); ++i )
+		{
+			if ( !files[ i ]->loaded )
+			{
+				pending.push_back( files[ i ] );
+			}
+		}
 		
-		lfh.sizeCompressed = read< sf::Uint32 >( ss );
-		lfh.sizeNormal = read< sf::Uint32 >( ss );
+		loadContents( pending, threads );
 	}
 	
-	void writeLocalFileHeaderBase( std::stringstream& ss, const LocalFileHeaderBase& lfh )
+	void File::loadContents( const std::vector< const Entry* >& entries, unsigned int threads )
 	{
-		write( ss, lfh.minVersion );
-		write( ss, lfh.flags );
-		write( ss, lfh.compressType );
-		
-		write( ss, lfh.lastModTime );
-		write( ss, lfh.lastModDate );
-		
-		write( ss, lfh.crc32 );
+		// Anything with checkpoints can use every thread by itself, so
+		// those go one at a time. The rest get a thread each.
+		std::vector< const Entry* > others;
+		for ( std::size_t i = 0; i < entries.size(); ++i )
+		{
+			std::lock_guard< std::mutex > lock( entries[ i ]->mutex );
+			if ( entries[ i ]->loaded )
+			{
+				continue;
+			}
+			else if ( threads != 1 and entries[ i ]->checkpoints.size() > 1 )
+			{
+				loadContents( * entries[ i ], threads );
+			}
+			else
+			{
+				others.push_back( entries[ i ] );
+			}
+		}
 		
-		write( ss, lfh.sizeCompressed );
-		write( ss, lfh.sizeNormal );
+		priv::parallelFor( others.size(), threads, [ & ]( std::size_t i )
+		{
+			std::lock_guard< std::mutex > lock( others[ i ]->mutex );
+			if ( !others[ i ]->loaded )
+			{
+				loadContents( * others[ i ] );
+			}
+		} );
 	}
 	
-	CentralDirectoryStructure readCentralDir( std::stringstream& ss )
+	void File::loadContents( const Entry& entry, unsigned int threads )
 	{
-		sf::Uint32 sig = read< sf::Uint32 >( ss );
-		
-		CentralDirectoryStructure cd;
-		
-		cd.versionMade = read< sf::Uint16 >( ss );
+		if ( !entry.archive )
+		{
+			throw std::runtime_error( "Entry has no archive to load from." );
+		}
 		
-		readLocalFileHeaderBase( ss, cd );
+		Counters* stats = entry.file->counters.get();
+		std::string_view raw = getRawContents( entry );
+		std::string contents;
+		sf::Uint32 crc = 0;
+		if ( entry.compressType == Compression::Deflated )
+		{
+			// The central directory always has the real sizes, even if the
+			// local header didn't
+			sf::Uint32* check = entry.verify ? &crc : NULL;
+			if ( threads != 1 and entry.checkpoints.size() > 1 )
+			{
+				contents = inflateParallel( raw, entry.sizeNormal, entry.checkpoints, threads, check, stats );
+			}
+			else
+			{
+				contents = getInflated( raw, entry.sizeNormal, check, stats );
+			}
+			addCount( stats, Counters::Allocations, 1 );
+		}
+		else if ( entry.verify )
+		{
+			PhaseTimer timer( stats, Counters::CrcTime );
+			crc = getCrc32( raw );
+		}
+		addCount( stats, Counters::CompressedBytes, raw.length() );
+		addCount( stats, Counters::UncompressedBytes, entry.sizeNormal );
 		
-		sf::Uint16 filenameLength = read< sf::Uint16 >( ss );
-		sf::Uint16 extraLength = read< sf::Uint16 >( ss );
-		sf::Uint16 commentLength = read< sf::Uint16 >( ss );
+		if ( entry.verify and crc != entry.crc32 )
+		{
+			throw std::runtime_error( "CRC-32 doesn't match for " + std::string( entry.path ) + "." );
+		}
 		
-		cd.diskNumStart = read< sf::Uint16 >( ss );
-		cd.inAttr = read< sf::Uint16 >( ss );
-		cd.exAttr = read< sf::Uint32 >( ss );
-		cd.localHeaderOffset = read< sf::Uint32 >( ss );
+		if ( entry.compressType != Compression::Deflated and !entry.archive->isBorrowed() )
+		{
+			// Stored data can be used right where it is
+			entry.mapped = raw;
+			entry.loaded = true;
+			return;
+		}
+		else if ( entry.compressType != Compression::Deflated )
+		{
+			contents.assign( raw.data(), raw.length() );
+			addCount( stats, Counters::Allocations, 1 );
+		}
 		
-		cd.filename = readStr( ss, filenameLength );
-		cd.extra = readStr( ss, extraLength );
-		cd.comment = readStr( ss, commentLength );
+		entry.contents.swap( contents );
+		entry.loaded = true;
+		entry.file->inflatedBytes += entry.contents.length();
 		
-		return cd;
+		// Anything we're allowed to hold on to is kept for saving clean
+		// entries without recompressing them.
+		if ( entry.archive->isBorrowed() )
+		{
+			entry.archive.reset();
+			Checkpoints().swap( entry.checkpoints );
+		}
 	}
 	
-	void writeCentralDir( std::stringstream& ss, const CentralDirectoryStructure& cd )
+	std::string_view File::getRawContents( const Entry& entry, std::string* extra )
 	{
-		writeStr( ss, makeSig( CentralDirectoryStructure::SIGNATURE ), 4 );
+		Counters* stats = entry.file->counters.get();
+		MemoryBuffer buffer( entry.archive->getData(), entry.archive->getSize() );
+		std::istream ss( &buffer );
 		
-		write( ss, cd.versionMade );
-		
-		writeLocalFileHeaderBase( ss, cd );
-		
-		write< sf::Uint16 >( ss, cd.filename.length() );
-		write< sf::Uint16 >( ss, cd.extra.length() );
-		write< sf::Uint16 >( ss, cd.comment.length() );
+		std::size_t pos;
+		{
+			PhaseTimer timer( stats, Counters::LocalHeaderTime );
+			ss.seekg( entry.headerOffset );
+			streamCheck( "lf pos" );
+			
+			LocalFileHeader lf = readLocalFileHeader( ss );
+			streamCheck( "lf" );
+			pos = ss.tellg();
+			
+			if ( extra != NULL )
+			{
+				extra->swap( lf.extra );
+			}
+		}
 		
-		write( ss, cd.diskNumStart );
-		write( ss, cd.inAttr );
-		write( ss, cd.exAttr );
-		write( ss, cd.localHeaderOffset );
+		// Sizes come from the central directory, since the local header's
+		// may be zero if they were postponed to a data descriptor.
+		if ( entry.sizeCompressed > entry.archive->getSize() - pos )
+		{
+			throw std::runtime_error( "Stream error (maybe too short?) at lf data" );
+		}
+		addCount( stats, Counters::BytesRead, pos - entry.headerOffset + entry.sizeCompressed );
 		
-		writeStr( ss, cd.filename, cd.filename.length() );
-		writeStr( ss, cd.extra, cd.extra.length() );
-		writeStr( ss, cd.comment, cd.comment.length() );
+		return std::string_view( entry.archive->getData() + pos, entry.sizeCompressed );
 	}
 	
-	LocalFileHeader readLocalFileHeader( std::stringstream& ss )
+	bool File::saveToFile( const std::string& filename, const SaveOptions& options )
 	{
-		sf::Uint32 sig = read< sf::Uint32 >( ss );
-		
-		LocalFileHeader lf;
+		// Entries may still be reading out of the old file, so it can't be
+		// truncated underneath them. Replacing it leaves them with the old
+		// one. If it's a link, what it points to is replaced instead.
+		class Temporary
+		{
+			public:
+				Temporary( const std::string& theFilename )
+				   : filename( theFilename ),
+				     kept( false )
+				{
+				}
+				
+				~Temporary()
+				{
+					if ( !kept and !filename.empty() )
+					{
+						std::remove( filename.c_str() );
+					}
+				}
+				
+				const std::string filename;
+				bool kept;
+		};
 		
-		readLocalFileHeaderBase( ss, lf );
+		std::string target = resolveLinks( filename );
+		Temporary temporary( makeTemporaryFile( target ) );
+		if ( temporary.filename.empty() )
+		{
+			return false;
+		}
 		
-		sf::Uint16 filenameLength = read< sf::Uint16 >( ss );
-		sf::Uint16 extraLength = read< sf::Uint16 >( ss );
+		{
+			std::fstream file( temporary.filename.c_str(), std::fstream::out | std::fstream::trunc | std::fstream::binary );
+			if ( !file or !save( file, options ) )
+			{
+				return false;
+			}
+			
+			file.close();
+			if ( !file )
+			{
+				return false;
+			}
+		}
 		
-		lf.filename = readStr( ss, filenameLength );
-		lf.extra = readStr( ss, extraLength );
+		if ( !replaceFile( temporary.filename, target ) )
+		{
+			print( "Couldn't move " << temporary.filename << " to " << target );
+			return false;
+		}
+		temporary.kept = true;
 		
-		return lf;
+		return true;
 	}
 	
-	void writeLocalFileHeader( std::stringstream& ss, const LocalFileHeader& lf )
+	void File::saveToMemory( std::string& contents, const SaveOptions& options )
 	{
-		writeStr( ss, makeSig( LocalFileHeader::SIGNATURE ), 4 );
-		
-		writeLocalFileHeaderBase( ss, lf );
-		
-		write< sf::Uint16 >( ss, lf.filename.length() );
-		write< sf::Uint16 >( ss, lf.extra.length() );
-		
-		writeStr( ss, lf.filename, lf.filename.length() );
-		writeStr( ss, lf.extra, lf.extra.length() );
+		std::stringstream ss( "", std::stringstream::out | std::stringstream::trunc | std::stringstream::binary );
+		if ( save( ss, options ) )
+		{
+			contents = ss.str();
+		}
 	}
 	
-	void readAndInflate( std::stringstream& ss, std::string& contents )
+	bool File::extractAll( const std::string& directory, const ExtractOptions& options )
 	{
-		std::size_t beforePos = ss.tellg();
-		
-		z_stream stream;
-		stream.zalloc = Z_NULL;
-		stream.zfree = Z_NULL;
-		stream.opaque = Z_NULL;
-		stream.next_in = Z_NULL;
-		stream.avail_in = 0;
-		
-		int ret = inflateInit2( &stream, -15 ); // -15 == use raw deflate data, not header/check values. Took me a while to find that :P
-		if ( ret != Z_OK )
-		{
-			throw std::runtime_error( "Failed to init zlib inflate." );
-		}
-		
-		class InflateEnder
+		Counters* stats = startStatistics( options.statistics );
+		try
 		{
-			public:
-				InflateEnder( z_stream& theStream )
-				   : stream( theStream )
+			std::vector< const Entry* > files;
+			std::vector< const Entry* > directories;
+			collectFiles( * this, files, &directories );
+			addCount( stats, Counters::Entries, files.size() );
+			
+			for ( std::size_t i = 0; i < directories.size(); ++i )
+			{
+				if ( !isSafePath( directories[ i ]->getPathView() ) )
 				{
+					throw std::runtime_error( "Won't extract outside the directory: " + std::string( directories[ i ]->getPathView() ) );
 				}
-				
-				~InflateEnder()
+			}
+			for ( std::size_t i = 0; i < files.size(); ++i )
+			{
+				if ( !isSafePath( files[ i ]->getPathView() ) )
 				{
-					inflateEnd( &stream );
+					throw std::runtime_error( "Won't extract outside the directory: " + std::string( files[ i ]->getPathView() ) );
 				}
+			}
 			
-			private:
-				z_stream& stream;
-		} ie( stream );
-		
-		constexpr std::size_t BUFFER_SIZE = 16;
-		unsigned char bufferIn[ BUFFER_SIZE ];
-		unsigned char bufferOut[ BUFFER_SIZE ];
-		do
-		{
-			ss.read( reinterpret_cast< char* >( bufferIn ), BUFFER_SIZE );
-			stream.avail_in = ss.gcount();
-			if ( ss.bad() )
+			// Parents always come first, so each only needs making once.
+			// Links already in the tree could lead anywhere, so only the
+			// directory we were given is allowed to go through them.
+			std::string root = directory;
+			if ( !root.empty() and root.back() != '/' )
 			{
-				throw std::runtime_error( "Some error with reading the stream?" );
+				root += '/';
 			}
-			
-			if ( stream.avail_in == 0 )
+			makeDirectories( root );
+			for ( std::size_t i = 0; i < directories.size(); ++i )
 			{
-				break;
+				makeDirectory( root + std::string( directories[ i ]->getPathView() ) );
 			}
 			
-			stream.next_in = bufferIn;
-			
-			do
+			parallelFor( files.size(), options.threads, [ & ]( std::size_t i )
 			{
-				stream.avail_out = BUFFER_SIZE;
-				stream.next_out = bufferOut;
-				ret = inflate( &stream, Z_NO_FLUSH );
-				
-				switch ( ret )
-				{
-					case Z_NEED_DICT:
-						//ret = Z_DATA_ERROR;
-					case Z_DATA_ERROR:
-						throw std::runtime_error( "Data error with inflate: " + util::toString( ret ) );
-						break;
-						
-					case Z_MEM_ERROR:
-						throw std::runtime_error( "Memory error with inflate: " + util::toString( ret ) );
-						break;
-						
-					case Z_STREAM_ERROR:
-						throw std::runtime_error( "Stream error with inflate: " + util::toString( ret ) );
-						break;
-				}
-				
-				unsigned int have = BUFFER_SIZE - stream.avail_out;
-				contents += std::string( reinterpret_cast< char* >( bufferOut ), have );
-			}
-			while ( stream.avail_out == 0 );
+				extractContents( * files[ i ], root + std::string( files[ i ]->getPathView() ), options.verify );
+			} );
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error extracting zip file, exception: " << exception.what() << std::endl );
+			return false;
 		}
-		while ( ret != Z_STREAM_END );
 		
-		ss.seekg( beforePos + stream.total_in );
+		return true;
 	}
 	
-	std::string getDeflated( const std::string& contents )
+	void File::extractContents( const Entry& entry, const std::string& filename, bool verify )
 	{
-		z_stream stream;
-		stream.zalloc = Z_NULL;
-		stream.zfree = Z_NULL;
-		stream.opaque = Z_NULL;
+		Counters* stats = entry.file->counters.get();
+		OutputFile out( filename );
 		
-		int ret = deflateInit2( &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ); // -15 == use raw deflate data, not header/check values. Took me a while to find that :P
-		if ( ret != Z_OK )
+		std::lock_guard< std::mutex > lock( entry.mutex );
+		if ( entry.loaded and entry.mapped.data() == NULL )
 		{
-			throw std::runtime_error( "Failed to init zlib inflate." );
+			out.write( entry.contents );
+			addCount( stats, Counters::BytesWritten, entry.contents.length() );
 		}
-		
-		class DeflateEnder
+		else
 		{
-			public:
-				DeflateEnder( z_stream& theStream )
-				   : stream( theStream )
+			// Still in the archive (or stored and used in place, in which
+			// case it was checked when it was loaded)
+			std::string_view raw = entry.loaded ? entry.mapped : getRawContents( entry );
+			verify = verify and !entry.loaded;
+			sf::Uint32 crc = 0;
+			if ( entry.compressType == Compression::Deflated )
+			{
+				std::string contents = getInflated( raw, entry.sizeNormal, verify ? &crc : NULL, stats );
+				addCount( stats, Counters::Allocations, 1 );
+				out.write( contents );
+			}
+			else
+			{
+				if ( verify )
 				{
+					PhaseTimer timer( stats, Counters::CrcTime );
+					crc = getCrc32( raw );
 				}
 				
-				~DeflateEnder()
+				sf::Uint64 copied = 0;
+				if ( entry.archive->getDescriptor() != -1 )
 				{
-					deflateEnd( &stream );
+					copied = out.copy( entry.archive->getDescriptor(), raw.data() - entry.archive->getData(), raw.length() );
 				}
+				out.write( raw.substr( copied ) );
+			}
 			
-			private:
-				z_stream& stream;
-		} de( stream );
-		
-		std::stringstream ss( contents, std::stringstream::in | std::stringstream::binary );
-		std::string toReturn;
+			if ( verify and crc != entry.crc32 )
+			{
+				throw std::runtime_error( "CRC-32 doesn't match for " + std::string( entry.path ) + "." );
+			}
+			addCount( stats, Counters::CompressedBytes, raw.length() );
+			addCount( stats, Counters::UncompressedBytes, entry.sizeNormal );
+			addCount( stats, Counters::BytesWritten, entry.sizeNormal );
+		}
 		
-		constexpr std::size_t BUFFER_SIZE = 16384;
-		unsigned char bufferIn[ BUFFER_SIZE ];
-		unsigned char bufferOut[ BUFFER_SIZE ];
-		do
+		// Ones that were just added with addFile() don't have a time worth
+		// keeping
+		std::time_t modified = 0;
+		if ( entry.lastModDate != 0 )
 		{
-			ss.read( reinterpret_cast< char* >( bufferIn ), BUFFER_SIZE );
-			stream.avail_in = ss.gcount();
-			if ( ss.bad() )
+			struct tm time = readDosTime( entry.lastModDate, entry.lastModTime );
+			modified = std::max< std::time_t >( std::mktime( &time ), 0 );
+		}
+		out.close( modified );
+	}
+	
+	bool File::save( std::ostream& ss, const SaveOptions& options )
+	{
+		Counters* stats = startStatistics( options.statistics );
+		try
+		{
+			std::vector< std::pair< LocalFileHeader, sf::Uint64 > > lfs;
+			sf::Uint64 offset = 0;
+			writeFiles( ss, lfs, offset, options.threads );
+			writeDirectory( ss, lfs, offset, std::vector< CentralDirectoryStructure >(), "", stats );
+			
+			if ( !ss )
 			{
-				throw std::runtime_error( "Some error with reading the stream?" );
+				throw std::runtime_error( "Stream error while writing." );
 			}
-			
-			if ( stream.avail_in == 0 )
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error saving zip file, exception: " << exception.what() << std::endl );
+			return false;
+		}
+		
+		return true;
+	}
+	
+	void File::writeFiles( std::ostream& ss, std::vector< std::pair< LocalFileHeader, sf::Uint64 > >& lfs, sf::Uint64& offset, unsigned int threads )
+	{
+		Counters* stats = counters.get();
+		std::vector< const Entry* > files;
+		collectFiles( * this, files );
+		addCount( stats, Counters::Entries, files.size() );
+		
+		// Everything gets the same timestamp, so the output doesn't depend
+		// on how long (or in what order) the compression happened.
+		struct tm time = getLocalTime( std::time( NULL ) );
+		
+		// Clean entries are copied over exactly as they were in the archive
+		// they came from, without going anywhere near zlib.
+		std::vector< CompressedFile > compressed( files.size() );
+		std::vector< std::string_view > data( files.size() );
+		parallelFor( files.size(), threads, [ & ]( std::size_t i )
+		{
+			const Entry& entry = ( * files[ i ] );
+			std::string path( entry.getPathView() );
+			if ( !entry.dirty and entry.archive and !entry.archive->isBorrowed() )
 			{
-				break;
+				LocalFileHeader& lf = compressed[ i ].header;
+				lf.minVersion = ( entry.sizeCompressed >= zip64Marker or entry.sizeNormal >= zip64Marker ) ? 45 : 20;
+				lf.flags = entry.flags & ~Flags::DataDescriptorPostponed; // We know the sizes up front now
+				lf.compressType = entry.compressType;
+				lf.lastModTime = entry.lastModTime;
+				lf.lastModDate = entry.lastModDate;
+				lf.crc32 = entry.crc32;
+				lf.sizeCompressed = entry.sizeCompressed;
+				lf.sizeNormal = entry.sizeNormal;
+				lf.filename = path;
+				data[ i ] = getRawContents( entry, &lf.extra );
+				
+				// Other extra fields (timestamps, owners and so on) go along
+				// as they are, but Zip64 and checkpoints are written again.
+				// Only the checkpoints that were saved with it are kept.
+				std::string field;
+				while ( takeExtraField( lf.extra, zip64ExtraId, field ) or takeExtraField( lf.extra, checkpointExtraId, field ) );
+				lf.extra += makeCheckpointExtra( entry.checkpoints );
 			}
-			
-			stream.next_in = bufferIn;
-			int flush = ss.eof() ? Z_FINISH : Z_NO_FLUSH;
-			
-			do
+			else
 			{
-				stream.avail_out = BUFFER_SIZE;
-				stream.next_out = bufferOut;
-				ret = deflate( &stream, flush );
+				compressed[ i ] = compressFile( entry.getContentsView(), path, time, entry.getCompression(), stats );
+				data[ i ] = compressed[ i ].data;
 				
-				switch ( ret )
+				// Unless it already has one of its own
+				if ( entry.lastModDate != 0 )
 				{
-					case Z_NEED_DICT:
-						//ret = Z_DATA_ERROR;
-					case Z_DATA_ERROR:
-					case Z_MEM_ERROR:
-					case Z_STREAM_ERROR:
-						throw std::runtime_error( "Some error with deflate: " + util::toString( ret ) );
+					compressed[ i ].header.lastModTime = entry.lastModTime;
+					compressed[ i ].header.lastModDate = entry.lastModDate;
 				}
-				
-				unsigned int have = BUFFER_SIZE - stream.avail_out;
-				toReturn += std::string( reinterpret_cast< char* >( bufferOut ), have );
+				addCount( stats, Counters::Allocations, 1 );
 			}
-			while ( stream.avail_out == 0 );
-		}
-		while ( ret != Z_STREAM_END );
+		} );
 		
-		return toReturn;
+		skippedBytes = 0;
+		sf::Uint64 start = offset;
+		lfs.reserve( lfs.size() + compressed.size() );
+		for ( std::size_t i = 0; i < compressed.size(); ++i )
+		{
+			lfs.push_back( std::make_pair( compressed[ i ].header, offset ) );
+			{
+				PhaseTimer timer( stats, Counters::LocalHeaderTime );
+				writeLocalFileHeader( ss, compressed[ i ].header );
+			}
+			ss.write( data[ i ].data(), data[ i ].length() );
+			offset += getSize( compressed[ i ].header ) + data[ i ].length();
+			skippedBytes += compressed[ i ].skipped ? data[ i ].length() : 0;
+			addCount( stats, Counters::CompressedBytes, compressed[ i ].header.sizeCompressed );
+			addCount( stats, Counters::UncompressedBytes, compressed[ i ].header.sizeNormal );
+			
+			std::string().swap( compressed[ i ].data );
+		}
+		addCount( stats, Counters::BytesWritten, offset - start );
 	}
 	
-	sf::Uint16 makeDosDate( struct tm* time )
+	sf::Uint64 File::getSkippedBytes() const
 	{
-		sf::Uint16 date = 0;
-		date ^= static_cast< sf::Uint16 >( ( time->tm_year - 80 ) & 0x7F ) << 9;
-		date ^= static_cast< sf::Uint16 >( ( time->tm_mon  +  1 ) & 0x0F ) << 5;
-		date ^= static_cast< sf::Uint16 >( ( time->tm_mday +  0 ) & 0x1F ) << 0;
-		return date;
+		return skippedBytes;
 	}
 	
-	sf::Uint16 makeDosTime( struct tm* theTime )
+	Statistics File::getStatistics() const
 	{
-		sf::Uint16 time = 0;
-		time ^= static_cast< sf::Uint16 >( ( theTime->tm_hour + 0 ) & 0x1F ) << 11;
-		time ^= static_cast< sf::Uint16 >( ( theTime->tm_min  + 0 ) & 0x3F ) <<  5;
-		time ^= static_cast< sf::Uint16 >( ( theTime->tm_mday / 2 ) & 0x1F ) <<  0;
-		return time;
+		return counters ? counters->get() : Statistics();
 	}
 	
-	void writeFile( std::stringstream& ss, const zip::priv::EntryBase& entry, std::vector< std::pair< LocalFileHeader, std::size_t > >& lfs, const std::string& pre = "" )
+	sf::Uint64 File::getInflatedSize() const
 	{
-		for ( auto it = entry.begin(); it != entry.end(); ++it )
+		return inflatedBytes;
+	}
+	
+	Counters* File::startStatistics( bool enabled )
+	{
+		if ( !enabled )
 		{
-			zip::Entry& entry = ( * it->get() );
-			if ( entry.isDirectory() )
-			{
-				writeFile( ss, entry, lfs, pre + entry.getName() + "/" );
-			}
-			else
-			{
-				LocalFileHeader lf;
-				lf.minVersion = 20; // Assuming this because I don't want to bother doing it properly :P
-				lf.flags = 0;
-				lf.compressType = Compression::Deflated; // TO DO: Choose based on Entry (somehow)
-				
-				// TO DO: Use cstdtime somehow
-				std::time_t rawTime; std::time( &rawTime );
-				struct tm* time = std::localtime( &rawTime );
-				lf.lastModTime = makeDosTime( time );
-				lf.lastModDate = makeDosDate( time );
-				
-				std::string data = getDeflated( entry.getContents() );
-				if ( data.length() >= entry.getContents().length() )
-				{
-					//lf.minVersion = 10;
-					lf.compressType = 0;
-					data = entry.getContents();
-				}
-				
-				lf.crc32 = util::crc32( entry.getContents() );//data/*, magicNumberCrc32*/ );
-				
-				lf.sizeCompressed = data.length();
-				lf.sizeNormal = entry.getContents().length();
-				
-				lf.filename = pre + entry.getName();
-				lf.extra = "";
-				
-				lfs.push_back( std::make_pair( lf, ss.tellp() ) );
-				writeLocalFileHeader( ss, lf );
-				ss.write( data.c_str(), data.length() );
-			}
+			counters.reset();
 		}
+		else if ( !counters )
+		{
+			counters.reset( new Counters() );
+		}
+		else
+		{
+			counters->reset();
+		}
+		
+		return counters.get();
 	}
-}
-
-namespace zip
-{
-	bool File::loadFromFile( const std::string& filename )
+	
+	void File::addFile( const std::string& path, const std::string& contents )
+	{
+		addFile( path, contents, CompressionOptions() );
+	}
+	
+	void File::addFile( const std::string& path, const std::string& contents, const CompressionOptions& compression )
 	{
-		std::fstream file( filename.c_str(), std::fstream::in | std::fstream::binary );
-		if ( !file )
+		Entry* entry = getEntry( path );
+		if ( entry == NULL )
 		{
-			return false;
+			entry = createEntryAt( getCanonicalPath( path ) );
 		}
 		
-		std::string contents;
-		while ( file )
+		releaseChildren( * entry );
+		entry->contents = contents;
+		entry->mapped = std::string_view();
+		entry->loaded = true;
+		entry->archive.reset();
+		Checkpoints().swap( entry->checkpoints );
+		entry->lastModTime = 0;
+		entry->lastModDate = 0;
+		entry->dir = false;
+		entry->dirty = true;
+		entry->compression = compression;
+	}
+	
+	void File::addDirectory( const std::string& path )
+	{
+		Entry* entry = getEntry( path );
+		if ( entry == NULL )
 		{
-			char c = file.get();
-			if ( file )
-			{
-				contents += c;
-			}
+			entry = createEntryAt( getCanonicalPath( path ) );
 		}
 		
-		return loadFromMemory( contents );
+		entry->dir = true;
 	}
 	
-	bool File::loadFromMemory( const std::string& contents )
+	bool File::addDirectoryTree( const std::string& directory, const std::string& prefix, const AddOptions& options )
 	{
-		std::stringstream ss( contents, std::stringstream::in | std::stringstream::binary );
+		// Each batch of files is read and compressed by one thread, into one
+		// buffer laid out like the middle of an archive, so small files
+		// don't each need their own
+		constexpr std::size_t BATCH_SIZE = 64;
 		
+		Counters* stats = startStatistics( options.statistics );
 		try
 		{
-			#define streamCheck( a ) if ( !ss ) { throw std::runtime_error( "Stream error (maybe too short?) at " + std::string( a ) ); }
-			
-			std::size_t endCentralDirPos = findEndCentralDir( contents );
-			if ( endCentralDirPos == std::string::npos )
-			{
-				print( "no end central dir" );
-				return false;
-			}
-			ss.seekg( endCentralDirPos );
-			streamCheck( "ecd pos" );
+			std::vector< std::string > files;
+			std::vector< std::string > directories;
+			listDirectory( directory, files, directories );
 			
-			EndCentralDirectoryStructure ecd = readEndCentralDir( ss );
-			ss.seekg( ecd.centralDirOffset );
-			streamCheck( "ecd" );
-			
-			std::vector< CentralDirectoryStructure > cds;
-			cds.reserve( ecd.entryCountDisk );
-			for ( std::size_t i = 0; i < ecd.entryCountDisk; ++i )
+			std::string base = getCanonicalPath( prefix );
+			if ( !base.empty() )
 			{
-				CentralDirectoryStructure cd = readCentralDir( ss );
-				cds.push_back( cd );
+				base += '/';
 			}
-			streamCheck( "cds" );
 			
-			std::vector< std::pair< LocalFileHeader, std::string > > lfs;
-			lfs.reserve( cds.size() );
-			for ( std::size_t i = 0; i < cds.size(); ++i )
+			std::vector< std::shared_ptr< ArchiveBuffer > > batches( ( files.size() + BATCH_SIZE - 1 ) / BATCH_SIZE );
+			std::vector< LocalFileHeader > headers( files.size() );
+			std::vector< sf::Uint64 > offsets( files.size() );
+			parallelFor( batches.size(), options.threads, [ & ]( std::size_t batch )
 			{
-				lfs.push_back( std::make_pair( LocalFileHeader(), std::string() ) );
-				auto& pair = lfs.back();
-				
-				ss.seekg( cds[ i ].localHeaderOffset );
-				pair.first = readLocalFileHeader( ss );
-				if ( pair.first.flags & Flags::DataDescriptorPostponed and pair.first.compressType != Compression::Deflated )
-				{
-					throw std::runtime_error( "Post-data-descriptors not supported on non-deflate targets." );
-				}
-				else if ( pair.first.compressType != Compression::None and pair.first.compressType != Compression::Deflated )
-				{
-					throw std::runtime_error( "Unsupported compression type " + util::toString( pair.first.compressType ) + " at " + util::toString( ss.tellg() ) );//+ " for file " + pair.first.filename + "." );
-				}
-				
-				if ( pair.first.compressType == Compression::Deflated )
+				std::ostringstream ss( std::ostringstream::out | std::ostringstream::binary );
+				std::string buffer;
+				for ( std::size_t i = batch * BATCH_SIZE; i < std::min( files.size(), ( batch + 1 ) * BATCH_SIZE ); ++i )
 				{
-					readAndInflate( ss, pair.second );
+					InputFile input( directory + "/" + files[ i ] );
+					std::string_view contents = input.read( buffer );
+					addCount( stats, Counters::BytesRead, contents.length() );
 					
-					if ( pair.first.flags & Flags::DataDescriptorPostponed )
+					CompressedFile compressed = compressFile( contents, base + files[ i ], getLocalTime( input.getModified() ), options.compression, stats );
+					offsets[ i ] = ss.tellp();
 					{
-						pair.first.crc32 = read< sf::Uint32 >( ss );
-						if ( std::string( reinterpret_cast< char* >( &crc32 ), 4 ) == makeSig( DataDescriptor::SIGNATURE ) )
-						{
-							pair.first.crc32 = read< sf::Uint32 >( ss );
-						}
-						
-						pair.first.sizeCompressed = read< sf::Uint32 >( ss );
-						pair.first.sizeNormal = read< sf::Uint32 >( ss );
+						PhaseTimer timer( stats, Counters::LocalHeaderTime );
+						writeLocalFileHeader( ss, compressed.header );
 					}
+					ss.write( compressed.data.data(), compressed.data.length() );
+					addCount( stats, Counters::CompressedBytes, compressed.header.sizeCompressed );
+					addCount( stats, Counters::UncompressedBytes, compressed.header.sizeNormal );
+					headers[ i ] = std::move( compressed.header );
 				}
-				else
+				
+				batches[ batch ].reset( new ArchiveBuffer() );
+				batches[ batch ]->assign( ss.str() );
+				addCount( stats, Counters::Allocations, 1 );
+			} );
+			
+			// Just like entries from a lazy load, so they're only inflated
+			// if someone asks for them
+			addCount( stats, Counters::Entries, files.size() );
+			PhaseTimer timer( stats, Counters::TreeTime );
+			for ( std::size_t i = 0; i < directories.size(); ++i )
+			{
+				addDirectory( base + directories[ i ] );
+			}
+			for ( std::size_t i = 0; i < files.size(); ++i )
+			{
+				const LocalFileHeader& lf = headers[ i ];
+				addFile( lf.filename, "", options.compression );
+				Entry* entry = getEntry( lf.filename );
+				entry->loaded = false;
+				entry->archive = batches[ i / BATCH_SIZE ];
+				entry->headerOffset = offsets[ i ];
+				entry->compressType = lf.compressType;
+				entry->sizeCompressed = lf.sizeCompressed;
+				entry->sizeNormal = lf.sizeNormal;
+				entry->flags = lf.flags;
+				entry->lastModTime = lf.lastModTime;
+				entry->lastModDate = lf.lastModDate;
+				entry->crc32 = lf.crc32;
+				entry->dirty = false;
+				if ( lf.compressType == Compression::Deflated )
 				{
-					pair.second = readStr( ss, pair.first.sizeCompressed );
+					entry->checkpoints = readCheckpointExtra( lf.extra, lf.sizeCompressed, lf.sizeNormal );
 				}
-				
-				if ( ss )
+				else
 				{
-					if ( pair.first.filename[ pair.first.filename.length() - 1 ] == '/' )
-					{
-						addDirectory( pair.first.filename.substr( 0, pair.first.filename.length() - 1 ) );
-					}
-					else
-					{
-						addFile( pair.first.filename, pair.second );
-					}
+					entry->compression.method = CompressionOptions::Stored;
 				}
 			}
-			streamCheck( "lfs" );
 		}
 		catch ( std::exception& exception )
 		{
-			print( "Error loading zip file, exception: " << exception.what() << std::endl );
+			print( "Error adding directory, exception: " << exception.what() << std::endl );
 			return false;
 		}
 		
 		return true;
 	}
 	
-	bool File::saveToFile( const std::string& filename )
+	bool File::removeEntry( const std::string& path )
 	{
-		std::fstream file( filename.c_str(), std::fstream::out | std::fstream::trunc | std::fstream::binary );
-		if ( !file )
+		Entry* entry = getEntry( path );
+		if ( entry == NULL )
 		{
 			return false;
 		}
 		
-		std::string contents;
-		saveToMemory( contents );
-		file.write( contents.c_str(), contents.length() );
-		
+		detach( * entry );
+		releaseChildren( * entry );
+		index.erase( entry->path );
+		entry->reset();
+		freeEntries.push_back( entry );
 		return true;
 	}
 	
-	void File::saveToMemory( std::string& contents )
+	bool File::renameEntry( const std::string& from, const std::string& to )
 	{
-		std::stringstream ss( "", std::stringstream::out | std::stringstream::trunc | std::stringstream::binary );
+		Entry* entry = getEntry( from );
+		std::string target = getCanonicalPath( to );
+		if ( entry == NULL or target.empty() or getEntry( target ) != NULL )
+		{
+			return false;
+		}
 		
-		try
+		// Can't go inside itself, or anything that isn't a directory
+		if ( target.compare( 0, entry->path.length(), entry->path ) == 0 and target[ entry->path.length() ] == '/' )
 		{
-			std::vector< std::pair< LocalFileHeader, std::size_t > > lfs;
-			lfs.reserve( children.size() );
-			writeFile( ss, ( * this ), lfs );
-			
-			std::streampos centralDirStart = ss.tellp();
-			for ( std::size_t i = 0; i < lfs.size(); ++i )
-			{
-				CentralDirectoryStructure cd;
-				cd.versionMade = 20;
-				
-				cd.minVersion = lfs[ i ].first.minVersion;
-				cd.flags = lfs[ i ].first.flags;
-				cd.compressType = lfs[ i ].first.compressType;
-				
-				cd.lastModTime = lfs[ i ].first.lastModTime;
-				cd.lastModDate = lfs[ i ].first.lastModDate;
-				
-				cd.crc32 = lfs[ i ].first.crc32;
-				
-				cd.sizeCompressed = lfs[ i ].first.sizeCompressed;
-				cd.sizeNormal = lfs[ i ].first.sizeNormal;
-				
-				cd.filename = lfs[ i ].first.filename;
-				cd.extra = lfs[ i ].first.extra;
-				
-				cd.comment = "";
-				
-				cd.diskNumStart = 0;//? i; // ?
-				cd.inAttr = 0;
-				cd.exAttr = 0;
-				cd.localHeaderOffset = lfs[ i ].second;
-				
-				writeCentralDir( ss, cd );
-			}
-			
+			return false;
+		}
+		for ( std::size_t slash = target.find( '/' ); slash != std::string::npos; slash = target.find( '/', slash + 1 ) )
+		{
+			const Entry* parent = getEntry( std::string_view( target ).substr( 0, slash ) );
+			if ( parent != NULL and !parent->isDirectory() )
 			{
-				EndCentralDirectoryStructure ecd;
-				ecd.diskNum = 0;
-				ecd.diskNumStartCentralDirectory = 0;
-				
-				ecd.entryCountDisk = lfs.size();
-				ecd.entryCountCentral = lfs.size();
-				
-				ecd.centralDirSize = ss.tellp() - centralDirStart;
-				ecd.centralDirOffset = centralDirStart;
-				
-				ecd.comment = "";
-				
-				writeEndCentralDir( ss, ecd );
+				return false;
 			}
-			
-			contents = ss.str();
 		}
-		catch ( std::exception& exception )
+		
+		detach( * entry );
+		priv::EntryBase* parent = this;
+		entry->parent = NULL;
+		std::size_t slash = target.rfind( '/' );
+		if ( slash != std::string::npos )
 		{
-			print( "Error saving zip file, exception: " << exception.what() << std::endl );
+			std::string_view parentPath = std::string_view( target ).substr( 0, slash );
+			entry->parent = getEntry( parentPath );
+			if ( entry->parent == NULL )
+			{
+				entry->parent = createEntryAt( parentPath );
+				entry->parent->dir = true;
+			}
+			parent = entry->parent;
 		}
+		parent->children.push_back( entry );
+		
+		// Nothing about the contents changes, so it stays clean
+		movePaths( * entry, target );
+		return true;
 	}
 	
-	void File::addFile( const std::string& path, const std::string& contents )
+	Entry* File::createEntryAt( std::string_view path )
 	{
-		Entry* entry = getEntry( path );
-		if ( entry == NULL )
+		priv::EntryBase* parent = this;
+		Entry* parentEntry = NULL;
+		std::size_t slash = path.rfind( '/' );
+		if ( slash != std::string_view::npos )
 		{
-			entry = createEntryAt( path );
+			std::string_view parentPath = path.substr( 0, slash );
+			parentEntry = getEntry( parentPath );
+			if ( parentEntry == NULL )
+			{
+				parentEntry = createEntryAt( parentPath );
+				parentEntry->dir = true;
+			}
+			parent = parentEntry;
 		}
 		
-		entry->children.clear();
-		entry->file = this;
-		entry->parent = getEntry( getParent( path ) );
-		entry->name = getName( path );
-		entry->contents = contents;
-		entry->dir = false;
+		Entry* created = allocateEntry();
+		created->file = this;
+		created->parent = parentEntry;
+		created->path = storePath( path );
+		created->name = created->path.substr( slash + 1 ); // npos + 1 == 0
+		parent->children.push_back( created );
+		index[ created->path ] = created;
+		return created;
 	}
 	
-	void File::addDirectory( const std::string& path )
+	void File::releaseChildren( Entry& entry )
 	{
-		Entry* entry = getEntry( path );
-		if ( entry == NULL )
+		for ( auto it = entry.begin(); it != entry.end(); ++it )
 		{
-			entry = createEntryAt( path );
+			releaseChildren( * it->get() );
+			index.erase( ( * it )->path );
+			( * it )->reset();
+			freeEntries.push_back( it->get() );
 		}
-		
-		//entry->children.clear();
-		entry->file = this;
-		entry->parent = getEntry( getParent( path ) );
-		entry->name = getName( path );
-		entry->dir = true;
+		entry.children.clear();
 	}
 	
-	std::string File::getParent( const std::string& path )
+	void File::detach( Entry& entry )
 	{
-		std::vector< std::string > tokens = util::tokenize( path , "/" );
-		if ( tokens.size() == 1 )
+		std::vector< priv::EntryPtr >& siblings = ( entry.parent != NULL ) ? entry.parent->children : children;
+		auto it = std::find_if( siblings.begin(), siblings.end(), [ & ]( const priv::EntryPtr& sibling )
 		{
-			return path;
-		}
-		else if ( tokens.size() == 2 )
+			return sibling.get() == &entry;
+		} );
+		if ( it != siblings.end() )
 		{
-			return tokens[ 0 ];
+			siblings.erase( it );
 		}
+	}
+	
+	void File::movePaths( Entry& entry, std::string_view path )
+	{
+		// The old paths stay in the pool, since it never gives anything back
+		index.erase( entry.path );
+		entry.path = storePath( path );
+		entry.name = entry.path.substr( entry.path.rfind( '/' ) + 1 ); // npos + 1 == 0
+		index[ entry.path ] = &entry;
 		
-		std::string parent;
-		for ( auto it = tokens.begin(); it != tokens.end() - 1; ++it )
+		// Anyone holding on to the old strings sees the new ones
+		Entry::Names* names = entry.names.load();
+		if ( names != NULL )
 		{
-			parent += ( * it );
-			if ( it != tokens.end() - 2 )
-			{
-				parent += '/';
-			}
+			names->name = entry.name;
+			names->path = entry.path;
 		}
 		
-		return parent;
+		for ( auto it = entry.begin(); it != entry.end(); ++it )
+		{
+			movePaths( * it->get(), std::string( path ) + "/" + std::string( ( * it )->name ) );
+		}
 	}
 	
-	std::string File::getName( const std::string& path )
+	Entry* File::allocateEntry()
 	{
-		std::vector< std::string > tokens = util::tokenize( path , "/" );
-		return tokens[ tokens.size() - 1 ];
+		if ( !freeEntries.empty() )
+		{
+			Entry* entry = freeEntries.back();
+			freeEntries.pop_back();
+			return entry;
+		}
+		
+		// Small archives shouldn't pay for a huge block, big ones shouldn't
+		// need thousands of them
+		if ( entriesLeft == 0 )
+		{
+			std::size_t count = static_cast< std::size_t >( 16 ) << std::min< std::size_t >( entryBlocks.size(), 8 );
+			entryBlocks.emplace_back( new Entry[ count ] );
+			addCount( counters.get(), Counters::Allocations, 1 );
+			nextEntry = entryBlocks.back().get();
+			entriesLeft = count;
+		}
+		
+		--entriesLeft;
+		return nextEntry++;
 	}
 	
-	Entry* File::createEntryAt( const std::string& path )
+	std::string_view File::storePath( std::string_view path )
 	{
-		priv::EntryBase* entry = this;
-		if ( getParent( path ) != path )
+		if ( path.length() > pathLeft )
 		{
-			std::string parent = getParent( path );
-			Entry* e = getEntry( parent );
-			if ( e == NULL )
-			{
-				e = createEntryAt( parent );
-				e->file = this;
-				e->parent = getEntry( getParent( parent ) );
-				e->name = getName( parent );
-				e->dir = true;
-			}
-			entry = e;
+			std::size_t size = std::max< std::size_t >( static_cast< std::size_t >( 1024 ) << std::min< std::size_t >( pathBlocks.size(), 6 ), path.length() );
+			pathBlocks.emplace_back( new char[ size ] );
+			addCount( counters.get(), Counters::Allocations, 1 );
+			nextPath = pathBlocks.back().get();
+			pathLeft = size;
 		}
 		
-		entry->children.emplace_back( new Entry() );
-		return entry->children.back().get();
+		std::copy( path.begin(), path.end(), nextPath );
+		std::string_view stored( nextPath, path.length() );
+		nextPath += path.length();
+		pathLeft -= path.length();
+		return stored;
+	}
+	
+	Entry* File::getEntry( std::string_view path )
+	{
+		return const_cast< Entry* >( static_cast< const File* >( this )->getEntry( path ) );
+	}
+	
+	const Entry* File::getEntry( std::string_view path ) const
+	{
+		// Only build a new string if the caller gave us something like "/a//b/"
+		auto it = isCanonicalPath( path ) ? index.find( path ) : index.find( getCanonicalPath( path ) );
+		return ( ( it == index.end() ) ? NULL : it->second );
 	}
 }
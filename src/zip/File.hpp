@@ -1,30 +1,194 @@
 #ifndef ZIP_FILE_HPP
 #define ZIP_FILE_HPP
 
+#include <atomic>
+#include <memory>
 #include <sstream> // How can I get rid of this?
+#include <SFML/Config.hpp>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "zip/CompressionOptions.hpp"
 #include "zip/Entry.hpp"
 #include "zip/EntryBase.hpp"
+#include "zip/Statistics.hpp"
 
 namespace zip
 {
+	namespace priv
+	{
+		class ArchiveBuffer;
+		struct LocalFileHeader;
+	}
+	
+	struct LoadOptions
+	{
+		// Only read the central directory up front, and inflate each entry
+		// the first time its contents are asked for. The archive stays open
+		// (mapped, or copied when loading from memory) while that's pending.
+		//
+		// Either way, the archive is kept for as long as entries from it
+		// are unchanged, so saving can copy their compressed data over as
+		// is. The exception is a non-lazy loadFromMemory, which doesn't
+		// copy the caller's buffer and so has to recompress everything.
+		bool lazy = false;
+		
+		// How many threads to inflate entries on when not lazy; 0 means
+		// one per core.
+		unsigned int threads = 1;
+		
+		// Check each entry against the CRC-32 in the archive as it's loaded.
+		// It's worked out while inflating, so it costs very little. A
+		// mismatch fails the load, or throws std::runtime_error from
+		// Entry::getContents() if lazy.
+		bool verify = false;
+		
+		// Keep count of what the load does, for File::getStatistics(). With
+		// lazy, entries inflated later on are added to it as they go.
+		bool statistics = false;
+	};
+	
+	struct SaveOptions
+	{
+		// How many threads to compress entries on; 0 means one per core.
+		// The output is the same regardless.
+		unsigned int threads = 1;
+		
+		// Keep count of what the save does, for File::getStatistics()
+		bool statistics = false;
+	};
+	
+	struct AddOptions
+	{
+		// How many threads to read and compress files on; 0 means one per
+		// core
+		unsigned int threads = 1;
+		
+		// Used for everything added
+		CompressionOptions compression;
+		
+		// Keep count of what adding does, for File::getStatistics()
+		bool statistics = false;
+	};
+	
+	struct ExtractOptions
+	{
+		// How many threads to inflate and write entries on; 0 means one per
+		// core. Waiting on the disk is a good part of it, so more than that
+		// can still help.
+		unsigned int threads = 1;
+		
+		// Check entries that are still in the archive against its CRC-32 on
+		// the way out. Ones that were already loaded were checked then, if
+		// LoadOptions::verify was on.
+		bool verify = false;
+		
+		// Keep count of what the extraction does, for File::getStatistics()
+		bool statistics = false;
+	};
+	
 	class File : public priv::EntryBase
 	{
 		public:
-			bool loadFromFile( const std::string& filename );
-			bool loadFromMemory( const std::string& contents );
+			bool loadFromFile( const std::string& filename, const LoadOptions& options = LoadOptions() );
+			bool loadFromMemory( const std::string& contents, const LoadOptions& options = LoadOptions() );
+			bool loadFromMemory( const void* data, std::size_t size, const LoadOptions& options = LoadOptions() );
+			void loadAll( unsigned int threads = 1 ); // Inflates anything still pending from a lazy load; throws std::runtime_error on failure
+			
+			// Goes to a temporary file next to filename first, so saving over
+			// the archive this was loaded from is fine, and a failed save
+			// leaves whatever was there alone. If filename is a link, the
+			// file it points to is replaced, and it keeps its permissions.
+			bool saveToFile( const std::string& filename, const SaveOptions& options = SaveOptions() );
+			void saveToMemory( std::string& contents, const SaveOptions& options = SaveOptions() );
+			
+			// Writes every entry out under directory (made if it isn't there),
+			// keeping the tree and the archive's timestamps. Anything still in
+			// the archive is inflated straight to disk without being kept, and
+			// stored entries in a mapped archive are copied by the kernel where
+			// it can. Fails without writing anything if a path would end up
+			// outside directory, and fails if a directory under it turns out
+			// to be a link; what was written before a failure is left there.
+			// Links where files go are replaced, not followed.
+			bool extractAll( const std::string& directory, const ExtractOptions& options = ExtractOptions() );
 			
-			bool saveToFile( const std::string& filename );
-			void saveToMemory( std::string& contents );
+			// How many bytes the last save stored without trying deflate on
+			// them, thanks to CompressionOptions::adaptive
+			sf::Uint64 getSkippedBytes() const;
+			
+			// From the last load or save that had statistics turned on, or all
+			// zeros if it didn't. Turning them off costs nothing more than a
+			// NULL check here and there.
+			Statistics getStatistics() const;
+			
+			// Roughly how much inflating entries has held on to since the
+			// last load: their contents, and checkpoints made for
+			// Entry::read(). Doesn't go back down when they're changed or
+			// removed, so it's only really useful for read-only archives.
+			sf::Uint64 getInflatedSize() const;
 			
 			void addFile( const std::string& path, const std::string& contents );
+			void addFile( const std::string& path, const std::string& contents, const CompressionOptions& compression );
 			void addDirectory( const std::string& path );
+			
+			// Adds everything under directory on disk, at prefix in the archive
+			// ("" for the top). Files are read and compressed on threads as
+			// they're found, and kept compressed, so saving just copies them
+			// over. They keep their modification times. Nothing is added if
+			// anything can't be read.
+			bool addDirectoryTree( const std::string& directory, const std::string& prefix = "", const AddOptions& options = AddOptions() );
+			
+			// Both take whole subtrees with them, and give back false if
+			// there's nothing at the path. Pointers to anything removed aren't
+			// valid afterwards. Renamed entries keep their compressed data, so
+			// saving still copies it over as is.
+			bool removeEntry( const std::string& path );
+			bool renameEntry( const std::string& from, const std::string& to ); // Fails if to is taken, or has a file on the way to it
+			
+			// Same as EntryBase::getEntry, but looks the whole path up at once
+			// instead of walking the tree, and doesn't allocate
+			Entry* getEntry( std::string_view path );
+			const Entry* getEntry( std::string_view path ) const;
 		
 		private:
-			std::string getParent( const std::string& path );
-			std::string getName( const std::string& path );
-			Entry* createEntryAt( const std::string& path );
+			Entry* createEntryAt( std::string_view path ); // path has to be canonical
+			void releaseChildren( Entry& entry );
+			void detach( Entry& entry ); // From its parent
+			void movePaths( Entry& entry, std::string_view path );
+			Entry* allocateEntry();
+			std::string_view storePath( std::string_view path );
+			
+			bool load( const std::shared_ptr< priv::ArchiveBuffer >& archive, const LoadOptions& options );
+			bool save( std::ostream& ss, const SaveOptions& options );
+			void writeFiles( std::ostream& ss, std::vector< std::pair< priv::LocalFileHeader, sf::Uint64 > >& lfs, sf::Uint64& offset, unsigned int threads );
+			static void loadContents( const Entry& entry, unsigned int threads = 1 ); // More than one thread only helps if it has checkpoints
+			static void loadContents( const std::vector< const Entry* >& entries, unsigned int threads ); // Skips any that are loaded already
+			static std::string_view getRawContents( const Entry& entry, std::string* extra = NULL ); // Still compressed, straight out of the archive; extra gets the local header's, minus Zip64
+			static void extractContents( const Entry& entry, const std::string& filename, bool verify );
+			
+			// Entries are handed out of blocks (and reused once released)
+			// instead of being allocated one by one, and their paths all go in
+			// a few big pool blocks. Neither ever moves, so Entry pointers and
+			// the index's keys stay valid.
+			std::vector< std::unique_ptr< Entry[] > > entryBlocks;
+			Entry* nextEntry = NULL;
+			std::size_t entriesLeft = 0;
+			std::vector< Entry* > freeEntries;
+			std::vector< std::unique_ptr< char[] > > pathBlocks;
+			char* nextPath = NULL;
+			std::size_t pathLeft = 0;
+			
+			std::unordered_map< std::string_view, Entry* > index; // Keys point at Entry::path
+			sf::Uint64 skippedBytes = 0;
+			std::atomic< sf::Uint64 > inflatedBytes{ 0 }; // Entries load on any thread
+			std::unique_ptr< priv::Counters > counters; // NULL unless statistics are on
+			
+			priv::Counters* startStatistics( bool enabled );
+			
+			friend class Entry;
 	};
 }
 
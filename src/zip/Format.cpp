@@ -0,0 +1,1107 @@
+#include "zip/Format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <util/String.hpp>
+#include <zlib.h>
+
+#include "zip/Checkpoints.hpp"
+#include "zip/Crc32.hpp"
+
+namespace
+{
+	// Like memchr, but finds the last occurrence
+	const char* findLast( const char* data, std::size_t size, char c )
+	{
+		#ifdef __GLIBC__
+			return static_cast< const char* >( memrchr( data, c, size ) );
+		#else
+			for ( const char* it = data + size; it != data; --it )
+			{
+				if ( * ( it - 1 ) == c )
+				{
+					return it - 1;
+				}
+			}
+			return NULL;
+		#endif
+	}
+	
+	// Bits 1 and 2 of the general purpose flags, which tell what deflate
+	// level was used. Purely informational.
+	sf::Uint16 getDeflateFlags( int level )
+	{
+		switch ( level )
+		{
+			case 8:
+			case 9:
+				return zip::priv::Flags::CompressionFlag1;
+			case 2:
+				return zip::priv::Flags::CompressionFlag2;
+			case 1:
+				return zip::priv::Flags::CompressionFlag1 | zip::priv::Flags::CompressionFlag2;
+			default:
+				return 0;
+		}
+	}
+	
+	sf::Uint32 mask( sf::Uint64 value )
+	{
+		return ( value >= zip::priv::zip64Marker ) ? zip::priv::zip64Marker : value;
+	}
+	
+	std::string makeZip64Extra( const std::vector< sf::Uint64 >& values )
+	{
+		using namespace zip::priv;
+		
+		std::ostringstream ss( std::ostringstream::out | std::ostringstream::binary );
+		write< sf::Uint16 >( ss, zip64ExtraId );
+		write< sf::Uint16 >( ss, values.size() * 8 );
+		for ( std::size_t i = 0; i < values.size(); ++i )
+		{
+			write< sf::Uint64 >( ss, values[ i ] );
+		}
+		
+		return ss.str();
+	}
+	
+	// 4.5.3: The central directory only has the values that didn't fit
+	std::vector< sf::Uint64 > getZip64Values( const zip::priv::CentralDirectoryStructure& cd )
+	{
+		using namespace zip::priv;
+		
+		std::vector< sf::Uint64 > values;
+		if ( cd.sizeNormal >= zip64Marker )
+		{
+			values.push_back( cd.sizeNormal );
+		}
+		if ( cd.sizeCompressed >= zip64Marker )
+		{
+			values.push_back( cd.sizeCompressed );
+		}
+		if ( cd.localHeaderOffset >= zip64Marker )
+		{
+			values.push_back( cd.localHeaderOffset );
+		}
+		
+		return values;
+	}
+	
+	bool needsZip64( const zip::priv::LocalFileHeader& lf )
+	{
+		return lf.zip64 or lf.sizeNormal >= zip::priv::zip64Marker or lf.sizeCompressed >= zip::priv::zip64Marker;
+	}
+	
+	bool needsZip64( const zip::priv::EndCentralDirectoryStructure& ecd )
+	{
+		return ecd.entryCountCentral >= zip::priv::zip64Marker16 or ecd.centralDirSize >= zip::priv::zip64Marker or ecd.centralDirOffset >= zip::priv::zip64Marker;
+	}
+	
+	// Formats that are already compressed, so deflate won't get anywhere
+	bool hasCompressedMagic( std::string_view data )
+	{
+		static const std::string_view magics[] =
+		{
+			std::string_view( "\xFF\xD8\xFF", 3 ), // JPEG
+			std::string_view( "\x89PNG", 4 ),
+			std::string_view( "GIF8", 4 ),
+			std::string_view( "PK\x03\x04", 4 ), // Zip, and everything built on it (jar, docx, ...)
+			std::string_view( "\x1F\x8B", 2 ), // gzip
+			std::string_view( "BZh", 3 ),
+			std::string_view( "\xFD" "7zXZ\x00", 6 ),
+			std::string_view( "7z\xBC\xAF\x27\x1C", 6 ),
+			std::string_view( "\x28\xB5\x2F\xFD", 4 ), // zstd
+			std::string_view( "OggS", 4 ),
+			std::string_view( "fLaC", 4 ),
+			std::string_view( "ID3", 3 ), // mp3
+		};
+		for ( std::string_view magic : magics )
+		{
+			if ( data.substr( 0, magic.length() ) == magic )
+			{
+				return true;
+			}
+		}
+		
+		// MP4/MOV, and WebP
+		if ( data.substr( 4, 4 ) == "ftyp" or ( data.substr( 0, 4 ) == "RIFF" and data.substr( 8, 4 ) == "WEBP" ) )
+		{
+			return true;
+		}
+		
+		return false;
+	}
+	
+	// Bits per byte, going by how often each byte shows up
+	double getEntropy( std::string_view data )
+	{
+		std::size_t counts[ 256 ] = {};
+		for ( char c : data )
+		{
+			++counts[ static_cast< unsigned char >( c ) ];
+		}
+		
+		double entropy = 0;
+		for ( std::size_t count : counts )
+		{
+			if ( count > 0 )
+			{
+				double p = static_cast< double >( count ) / data.length();
+				entropy -= p * std::log2( p );
+			}
+		}
+		
+		return entropy;
+	}
+	
+	// Guesses from the start of the data whether deflating all of it is going
+	// to be a waste. Anything that looks random enough gets a quick trial run
+	// on that much, since entropy alone can't see repeated strings.
+	bool isWorthDeflating( std::string_view data )
+	{
+		constexpr std::size_t SAMPLE_SIZE = 65536;
+		if ( data.length() < 4096 )
+		{
+			return true; // Too cheap to bother guessing
+		}
+		else if ( hasCompressedMagic( data ) )
+		{
+			return false;
+		}
+		
+		std::string_view sample = data.substr( 0, SAMPLE_SIZE );
+		if ( getEntropy( sample ) < 7.5 )
+		{
+			return true;
+		}
+		
+		zip::CompressionOptions fast;
+		fast.level = 1;
+		return zip::priv::getDeflated( sample, fast ).length() < sample.length() * 0.97;
+	}
+}
+
+namespace zip
+{
+	namespace priv
+	{
+		std::string readStr( std::istream& ss, std::size_t len )
+		{
+			std::string str( len, '\0' );
+			if ( len > 0 )
+			{
+				ss.read( &str[ 0 ], len );
+			}
+			
+			return str;
+		}
+		
+		void writeStr( std::ostream& ss, const std::string& str, std::size_t len )
+		{
+			ss.write( &str[ 0 ], len );
+		}
+		
+		std::string makeSig( sf::Uint16 sig )
+		{
+			// Not sure why
+			#ifdef SFML_ENDIAN_LITTLE
+				sig = util::swapBytes( sig );
+			#endif
+			
+			std::string str1 = "PK";
+			std::string str2( reinterpret_cast< const char* >( &sig ), 2 );
+			return str1 + str2;
+		}
+		
+		bool takeExtraField( std::string& extra, sf::Uint16 id, std::string& field )
+		{
+			MemoryBuffer buffer( extra.data(), extra.length() );
+			std::istream ss( &buffer );
+			for ( std::size_t pos = 0; pos + 4 <= extra.length(); )
+			{
+				sf::Uint16 fieldId = read< sf::Uint16 >( ss );
+				sf::Uint16 size = read< sf::Uint16 >( ss );
+				if ( fieldId == id )
+				{
+					field = readStr( ss, size );
+					if ( !ss )
+					{
+						throw std::runtime_error( "Extra field " + util::toString( id ) + " is cut off." );
+					}
+					
+					extra.erase( pos, 4 + size );
+					return true;
+				}
+				
+				pos += 4 + size;
+				ss.seekg( pos );
+			}
+			
+			return false;
+		}
+		
+		std::size_t findEndCentralDir( const char* data, std::size_t size )
+		{
+			// 4.3.16: The record is 22 bytes, followed by a comment of at most
+			// 65535, so there's no point looking any further back than that.
+			constexpr std::size_t RECORD_SIZE = 22;
+			constexpr std::size_t MAX_COMMENT_SIZE = 0xFFFF;
+			if ( size < RECORD_SIZE )
+			{
+				return std::string::npos;
+			}
+			
+			std::size_t lowest = ( size > RECORD_SIZE + MAX_COMMENT_SIZE ) ? size - RECORD_SIZE - MAX_COMMENT_SIZE : 0;
+			std::size_t end = size - RECORD_SIZE + 1;
+			
+			std::string sig = makeSig( EndCentralDirectoryStructure::SIGNATURE );
+			while ( end > lowest )
+			{
+				const char* found = findLast( data + lowest, end - lowest, sig[ 0 ] );
+				if ( found == NULL )
+				{
+					break;
+				}
+				
+				std::size_t pos = found - data;
+				if ( std::memcmp( found, sig.c_str(), 4 ) == 0 )
+				{
+					// Make sure the comment actually fits, in case this is just
+					// some bytes in the middle of the last entry that look right.
+					std::size_t commentLength = static_cast< unsigned char >( found[ 20 ] ) | ( static_cast< unsigned char >( found[ 21 ] ) << 8 );
+					if ( pos + RECORD_SIZE + commentLength <= size )
+					{
+						return pos;
+					}
+				}
+				
+				end = pos;
+			}
+			
+			return std::string::npos;
+		}
+		
+		EndCentralDirectoryStructure readEndCentralDir( std::istream& ss )
+		{
+			sf::Uint32 sig = read< sf::Uint32 >( ss );
+			
+			EndCentralDirectoryStructure ecd;
+			
+			ecd.diskNum = read< sf::Uint16 >( ss );
+			ecd.diskNumStartCentralDirectory = read< sf::Uint16 >( ss );
+			
+			ecd.entryCountDisk = read< sf::Uint16 >( ss );
+			ecd.entryCountCentral = read< sf::Uint16 >( ss );
+			
+			if ( ecd.entryCountDisk != ecd.entryCountCentral )
+			{
+				throw std::runtime_error( "Don't know what to do/say." );
+			}
+			
+			ecd.centralDirSize = read< sf::Uint32 >( ss );
+			ecd.centralDirOffset = read< sf::Uint32 >( ss );
+			
+			ecd.comment = readStr< sf::Uint16 >( ss );
+			
+			return ecd;
+		}
+		
+		void writeEndCentralDir( std::ostream& ss, EndCentralDirectoryStructure& ecd )
+		{
+			writeStr( ss, makeSig( EndCentralDirectoryStructure::SIGNATURE ), 4 );
+			
+			write< sf::Uint16 >( ss, ecd.diskNum );
+			write< sf::Uint16 >( ss, ecd.diskNumStartCentralDirectory );
+			
+			write< sf::Uint16 >( ss, std::min< sf::Uint64 >( ecd.entryCountDisk, zip64Marker16 ) );
+			write< sf::Uint16 >( ss, std::min< sf::Uint64 >( ecd.entryCountCentral, zip64Marker16 ) );
+			
+			write< sf::Uint32 >( ss, mask( ecd.centralDirSize ) );
+			write< sf::Uint32 >( ss, mask( ecd.centralDirOffset ) );
+			
+			writeStr< sf::Uint16 >( ss, ecd.comment );
+		}
+		
+		bool readZip64EndCentralDir( std::istream& ss, std::size_t endCentralDirPos, EndCentralDirectoryStructure& ecd )
+		{
+			// The locator is 20 bytes and sits right before the regular record
+			if ( endCentralDirPos < 20 )
+			{
+				return false;
+			}
+			
+			ss.seekg( endCentralDirPos - 20 );
+			if ( readStr( ss, 4 ) != makeSig( Zip64EndCentralDirectoryLocator::SIGNATURE ) )
+			{
+				ss.clear();
+				return false;
+			}
+			
+			Zip64EndCentralDirectoryLocator locator;
+			locator.diskNum = read< sf::Uint32 >( ss );
+			locator.endCentralDirOffset = read< sf::Uint64 >( ss );
+			locator.diskCount = read< sf::Uint32 >( ss );
+			
+			ss.seekg( locator.endCentralDirOffset );
+			if ( !ss or readStr( ss, 4 ) != makeSig( Zip64EndCentralDirectoryStructure::SIGNATURE ) )
+			{
+				throw std::runtime_error( "Zip64 locator doesn't point at a Zip64 end of central directory record." );
+			}
+			
+			read< sf::Uint64 >( ss ); // Size of the rest of the record
+			read< sf::Uint16 >( ss ); // Version made by
+			read< sf::Uint16 >( ss ); // Version needed
+			
+			ecd.diskNum = read< sf::Uint32 >( ss );
+			ecd.diskNumStartCentralDirectory = read< sf::Uint32 >( ss );
+			
+			ecd.entryCountDisk = read< sf::Uint64 >( ss );
+			ecd.entryCountCentral = read< sf::Uint64 >( ss );
+			
+			if ( ecd.entryCountDisk != ecd.entryCountCentral )
+			{
+				throw std::runtime_error( "Don't know what to do/say." );
+			}
+			
+			ecd.centralDirSize = read< sf::Uint64 >( ss );
+			ecd.centralDirOffset = read< sf::Uint64 >( ss );
+			
+			if ( !ss )
+			{
+				throw std::runtime_error( "Zip64 end of central directory record is cut off." );
+			}
+			
+			return true;
+		}
+		
+		std::size_t writeZip64EndCentralDir( std::ostream& ss, const EndCentralDirectoryStructure& ecd, sf::Uint64 endCentralDirOffset )
+		{
+			if ( !needsZip64( ecd ) )
+			{
+				return 0;
+			}
+			
+			writeStr( ss, makeSig( Zip64EndCentralDirectoryStructure::SIGNATURE ), 4 );
+			write< sf::Uint64 >( ss, 44 );
+			write< sf::Uint16 >( ss, 45 );
+			write< sf::Uint16 >( ss, 45 );
+			write< sf::Uint32 >( ss, ecd.diskNum );
+			write< sf::Uint32 >( ss, ecd.diskNumStartCentralDirectory );
+			write< sf::Uint64 >( ss, ecd.entryCountDisk );
+			write< sf::Uint64 >( ss, ecd.entryCountCentral );
+			write< sf::Uint64 >( ss, ecd.centralDirSize );
+			write< sf::Uint64 >( ss, ecd.centralDirOffset );
+			
+			writeStr( ss, makeSig( Zip64EndCentralDirectoryLocator::SIGNATURE ), 4 );
+			write< sf::Uint32 >( ss, 0 );
+			write< sf::Uint64 >( ss, endCentralDirOffset );
+			write< sf::Uint32 >( ss, 1 );
+			
+			return 56 + 20;
+		}
+		
+		void readLocalFileHeaderBase( std::istream& ss, LocalFileHeaderBase& lfh )
+		{
+			lfh.minVersion = read< sf::Uint16 >( ss );
+			lfh.flags = read< sf::Uint16 >( ss );
+			lfh.compressType = read< sf::Uint16 >( ss );
+			
+			lfh.lastModTime = read< sf::Uint16 >( ss );
+			lfh.lastModDate = read< sf::Uint16 >( ss );
+			
+			lfh.crc32 = read< sf::Uint32 >( ss );
+			
+			lfh.sizeCompressed = read< sf::Uint32 >( ss );
+			lfh.sizeNormal = read< sf::Uint32 >( ss );
+		}
+		
+		void writeLocalFileHeaderBase( std::ostream& ss, const LocalFileHeaderBase& lfh, bool maskBothSizes )
+		{
+			write( ss, lfh.minVersion );
+			write( ss, lfh.flags );
+			write( ss, lfh.compressType );
+			
+			write( ss, lfh.lastModTime );
+			write( ss, lfh.lastModDate );
+			
+			write( ss, lfh.crc32 );
+			
+			// 4.5.3: Local headers have to mask both if either doesn't fit
+			write< sf::Uint32 >( ss, maskBothSizes ? zip64Marker : mask( lfh.sizeCompressed ) );
+			write< sf::Uint32 >( ss, maskBothSizes ? zip64Marker : mask( lfh.sizeNormal ) );
+		}
+		
+		CentralDirectoryStructure readCentralDir( std::istream& ss )
+		{
+			if ( readStr( ss, 4 ) != makeSig( CentralDirectoryStructure::SIGNATURE ) )
+			{
+				throw std::runtime_error( "Bad central directory signature." );
+			}
+			
+			CentralDirectoryStructure cd;
+			
+			cd.versionMade = read< sf::Uint16 >( ss );
+			
+			readLocalFileHeaderBase( ss, cd );
+			
+			sf::Uint16 filenameLength = read< sf::Uint16 >( ss );
+			sf::Uint16 extraLength = read< sf::Uint16 >( ss );
+			sf::Uint16 commentLength = read< sf::Uint16 >( ss );
+			
+			cd.diskNumStart = read< sf::Uint16 >( ss );
+			cd.inAttr = read< sf::Uint16 >( ss );
+			cd.exAttr = read< sf::Uint32 >( ss );
+			cd.localHeaderOffset = read< sf::Uint32 >( ss );
+			
+			cd.filename = readStr( ss, filenameLength );
+			cd.extra = readStr( ss, extraLength );
+			cd.comment = readStr( ss, commentLength );
+			
+			std::string zip64;
+			if ( takeExtraField( cd.extra, zip64ExtraId, zip64 ) )
+			{
+				cd.zip64 = true;
+				
+				MemoryBuffer buffer( zip64.data(), zip64.length() );
+				std::istream zs( &buffer );
+				if ( cd.sizeNormal == zip64Marker )
+				{
+					cd.sizeNormal = read< sf::Uint64 >( zs );
+				}
+				if ( cd.sizeCompressed == zip64Marker )
+				{
+					cd.sizeCompressed = read< sf::Uint64 >( zs );
+				}
+				if ( cd.localHeaderOffset == zip64Marker )
+				{
+					cd.localHeaderOffset = read< sf::Uint64 >( zs );
+				}
+				
+				if ( !zs )
+				{
+					throw std::runtime_error( "Zip64 extra field for " + cd.filename + " is too short." );
+				}
+			}
+			
+			return cd;
+		}
+		
+		void writeCentralDir( std::ostream& ss, const CentralDirectoryStructure& cd )
+		{
+			writeStr( ss, makeSig( CentralDirectoryStructure::SIGNATURE ), 4 );
+			
+			write( ss, cd.versionMade );
+			
+			writeLocalFileHeaderBase( ss, cd, false );
+			
+			std::vector< sf::Uint64 > zip64 = getZip64Values( cd );
+			std::string extra = zip64.empty() ? cd.extra : makeZip64Extra( zip64 ) + cd.extra;
+			
+			write< sf::Uint16 >( ss, cd.filename.length() );
+			write< sf::Uint16 >( ss, extra.length() );
+			write< sf::Uint16 >( ss, cd.comment.length() );
+			
+			write( ss, cd.diskNumStart );
+			write( ss, cd.inAttr );
+			write( ss, cd.exAttr );
+			write< sf::Uint32 >( ss, mask( cd.localHeaderOffset ) );
+			
+			writeStr( ss, cd.filename, cd.filename.length() );
+			writeStr( ss, extra, extra.length() );
+			writeStr( ss, cd.comment, cd.comment.length() );
+		}
+		
+		LocalFileHeader readLocalFileHeader( std::istream& ss )
+		{
+			sf::Uint32 sig = read< sf::Uint32 >( ss );
+			
+			LocalFileHeader lf;
+			
+			readLocalFileHeaderBase( ss, lf );
+			
+			sf::Uint16 filenameLength = read< sf::Uint16 >( ss );
+			sf::Uint16 extraLength = read< sf::Uint16 >( ss );
+			
+			lf.filename = readStr( ss, filenameLength );
+			lf.extra = readStr( ss, extraLength );
+			
+			// Unlike the central directory, both sizes are always there. They
+			// might just be zero if there's a data descriptor.
+			std::string zip64;
+			if ( takeExtraField( lf.extra, zip64ExtraId, zip64 ) )
+			{
+				lf.zip64 = true;
+				
+				MemoryBuffer buffer( zip64.data(), zip64.length() );
+				std::istream zs( &buffer );
+				sf::Uint64 sizeNormal = read< sf::Uint64 >( zs );
+				sf::Uint64 sizeCompressed = read< sf::Uint64 >( zs );
+				if ( zs )
+				{
+					lf.sizeNormal = sizeNormal;
+					lf.sizeCompressed = sizeCompressed;
+				}
+			}
+			
+			return lf;
+		}
+		
+		void writeLocalFileHeader( std::ostream& ss, const LocalFileHeader& lf )
+		{
+			writeStr( ss, makeSig( LocalFileHeader::SIGNATURE ), 4 );
+			
+			bool zip64 = needsZip64( lf );
+			writeLocalFileHeaderBase( ss, lf, zip64 );
+			
+			std::string extra = lf.extra;
+			if ( zip64 )
+			{
+				std::vector< sf::Uint64 > values;
+				values.push_back( lf.sizeNormal );
+				values.push_back( lf.sizeCompressed );
+				extra = makeZip64Extra( values ) + extra;
+			}
+			
+			write< sf::Uint16 >( ss, lf.filename.length() );
+			write< sf::Uint16 >( ss, extra.length() );
+			
+			writeStr( ss, lf.filename, lf.filename.length() );
+			writeStr( ss, extra, extra.length() );
+		}
+		
+		void readAndInflate( std::istream& ss, std::string& contents )
+		{
+			std::size_t beforePos = ss.tellg();
+			
+			z_stream stream;
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			stream.next_in = Z_NULL;
+			stream.avail_in = 0;
+			
+			int ret = inflateInit2( &stream, -15 ); // -15 == use raw deflate data, not header/check values. Took me a while to find that :P
+			if ( ret != Z_OK )
+			{
+				throw std::runtime_error( "Failed to init zlib inflate." );
+			}
+			
+			class InflateEnder
+			{
+				public:
+					InflateEnder( z_stream& theStream )
+					   : stream( theStream )
+					{
+					}
+					
+					~InflateEnder()
+					{
+						inflateEnd( &stream );
+					}
+				
+				private:
+					z_stream& stream;
+			} ie( stream );
+			
+			constexpr std::size_t BUFFER_SIZE = 16384;
+			unsigned char bufferIn[ BUFFER_SIZE ];
+			unsigned char bufferOut[ BUFFER_SIZE ];
+			do
+			{
+				ss.read( reinterpret_cast< char* >( bufferIn ), BUFFER_SIZE );
+				stream.avail_in = ss.gcount();
+				if ( ss.bad() )
+				{
+					throw std::runtime_error( "Some error with reading the stream?" );
+				}
+				
+				if ( stream.avail_in == 0 )
+				{
+					throw std::runtime_error( "Stream ended in the middle of deflated data." );
+				}
+				
+				stream.next_in = bufferIn;
+				
+				do
+				{
+					stream.avail_out = BUFFER_SIZE;
+					stream.next_out = bufferOut;
+					ret = inflate( &stream, Z_NO_FLUSH );
+					
+					switch ( ret )
+					{
+						case Z_NEED_DICT:
+							//ret = Z_DATA_ERROR;
+						case Z_DATA_ERROR:
+							throw std::runtime_error( "Data error with inflate: " + util::toString( ret ) );
+							break;
+						
+						case Z_MEM_ERROR:
+							throw std::runtime_error( "Memory error with inflate: " + util::toString( ret ) );
+							break;
+						
+						case Z_STREAM_ERROR:
+							throw std::runtime_error( "Stream error with inflate: " + util::toString( ret ) );
+							break;
+					}
+					
+					unsigned int have = BUFFER_SIZE - stream.avail_out;
+					contents.append( reinterpret_cast< char* >( bufferOut ), have );
+				}
+				while ( stream.avail_out == 0 and ret != Z_STREAM_END );
+			}
+			while ( ret != Z_STREAM_END );
+			
+			// We probably read past the end, maybe past the end of the stream
+			ss.clear();
+			ss.seekg( beforePos + stream.total_in );
+		}
+		
+		std::string getInflated( std::string_view data, sf::Uint64 size, sf::Uint32* crc, Counters* counters )
+		{
+			z_stream stream;
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			stream.next_in = Z_NULL;
+			stream.avail_in = 0;
+			
+			int ret = inflateInit2( &stream, -15 ); // Raw deflate data, see readAndInflate()
+			if ( ret != Z_OK )
+			{
+				throw std::runtime_error( "Failed to init zlib inflate." );
+			}
+			
+			class InflateEnder
+			{
+				public:
+					InflateEnder( z_stream& theStream )
+					   : stream( theStream )
+					{
+					}
+					
+					~InflateEnder()
+					{
+						inflateEnd( &stream );
+					}
+				
+				private:
+					z_stream& stream;
+			} ie( stream );
+			
+			// One call does it unless something's over avail_in/avail_out's 32
+			// bits. With a CRC to work out, the output goes in smaller pieces
+			// instead, so each one is still in cache when it's checked.
+			constexpr std::size_t MAX_CHUNK = 1 << 30;
+			std::size_t outChunk = ( crc != NULL ) ? 262144 : MAX_CHUNK;
+			
+			// Most things fit in what's made up front. Anything squashed better
+			// than that grows as it's inflated, so a made up size only gets
+			// as far as the data actually goes.
+			constexpr sf::Uint64 MIN_GUESS = 1 << 20;
+			checkInflatedSize( data, size );
+			std::string contents( std::min< sf::Uint64 >( size, std::max< sf::Uint64 >( data.length() * 8, MIN_GUESS ) ), '\0' );
+			std::size_t in = 0;
+			std::size_t out = 0;
+			do
+			{
+				if ( out == contents.length() and out < size )
+				{
+					contents.resize( std::min< sf::Uint64 >( size, contents.length() * 2 ) );
+				}
+				
+				stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( data.data() + in ) );
+				stream.avail_in = std::min( data.length() - in, MAX_CHUNK );
+				stream.next_out = reinterpret_cast< Bytef* >( &contents[ out ] );
+				stream.avail_out = std::min( contents.length() - out, outChunk );
+				uInt availIn = stream.avail_in;
+				uInt availOut = stream.avail_out;
+				
+				{
+					PhaseTimer timer( counters, Counters::InflateTime );
+					ret = inflate( &stream, Z_NO_FLUSH );
+				}
+				switch ( ret )
+				{
+					case Z_NEED_DICT:
+					case Z_DATA_ERROR:
+						throw std::runtime_error( "Data error with inflate: " + util::toString( ret ) );
+					
+					case Z_MEM_ERROR:
+						throw std::runtime_error( "Memory error with inflate: " + util::toString( ret ) );
+					
+					case Z_STREAM_ERROR:
+						throw std::runtime_error( "Stream error with inflate: " + util::toString( ret ) );
+					
+					case Z_BUF_ERROR:
+						throw std::runtime_error( "Deflated data is shorter or longer than it should be." );
+				}
+				
+				in += availIn - stream.avail_in;
+				if ( crc != NULL )
+				{
+					PhaseTimer timer( counters, Counters::CrcTime );
+					* crc = updateCrc32( * crc, &contents[ out ], availOut - stream.avail_out );
+				}
+				out += availOut - stream.avail_out;
+			}
+			while ( ret != Z_STREAM_END );
+			
+			if ( out != size )
+			{
+				throw std::runtime_error( "Deflated data is shorter or longer than it should be." );
+			}
+			
+			return contents;
+		}
+		
+		void checkInflatedSize( std::string_view data, sf::Uint64 size )
+		{
+			// 258 bytes from a length and distance of a bit each, plus some
+			// slack for the block headers
+			constexpr sf::Uint64 MAX_RATIO = 1032;
+			if ( size > data.length() * MAX_RATIO + 1024 )
+			{
+				throw std::runtime_error( "Inflated size " + util::toString( size ) + " is more than " + util::toString( data.length() ) + " deflated bytes can hold." );
+			}
+		}
+		
+		std::string getDeflated( std::string_view contents, const CompressionOptions& options, sf::Uint32* crc, Checkpoints* checkpoints, Counters* counters )
+		{
+			z_stream stream;
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			
+			int ret = deflateInit2( &stream, options.level, Z_DEFLATED, -options.windowBits, options.memLevel, options.strategy ); // Negative == use raw deflate data, not header/check values. Took me a while to find that :P
+			if ( ret != Z_OK )
+			{
+				throw std::runtime_error( "Failed to init zlib deflate (bad compression options?)." );
+			}
+			
+			class DeflateEnder
+			{
+				public:
+					DeflateEnder( z_stream& theStream )
+					   : stream( theStream )
+					{
+					}
+					
+					~DeflateEnder()
+					{
+						deflateEnd( &stream );
+					}
+				
+				private:
+					z_stream& stream;
+			} de( stream );
+			
+			std::string toReturn;
+			
+			// Fed straight from contents, a chunk at a time so the CRC can be
+			// worked out on each one while it's in cache. The last chunk has to
+			// go in with Z_FINISH, even if it's empty, or the stream never gets
+			// ended. Chunks also stop at each checkpoint, where the deflater gets
+			// fully flushed so nothing after it refers back to before it.
+			constexpr std::size_t BUFFER_SIZE = 16384;
+			unsigned char bufferOut[ BUFFER_SIZE ];
+			sf::Uint64 done = 0;
+			sf::Uint64 nextCheckpoint = ( checkpoints != NULL and options.checkpointSpacing > 0 ) ? options.checkpointSpacing : contents.length() + 1;
+			if ( checkpoints != NULL )
+			{
+				checkpoints->assign( 1, Checkpoint() );
+			}
+			do
+			{
+				std::size_t length = std::min< sf::Uint64 >( std::min< std::size_t >( contents.length(), 65536 ), nextCheckpoint - done );
+				if ( crc != NULL )
+				{
+					PhaseTimer timer( counters, Counters::CrcTime );
+					* crc = updateCrc32( * crc, contents.data(), length );
+				}
+				stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( contents.data() ) );
+				stream.avail_in = length;
+				contents.remove_prefix( length );
+				done += length;
+				int flush = contents.empty() ? Z_FINISH : ( ( done == nextCheckpoint ) ? Z_FULL_FLUSH : Z_NO_FLUSH );
+				
+				PhaseTimer timer( counters, Counters::DeflateTime );
+				do
+				{
+					stream.avail_out = BUFFER_SIZE;
+					stream.next_out = bufferOut;
+					ret = deflate( &stream, flush );
+					
+					switch ( ret )
+					{
+						case Z_NEED_DICT:
+							//ret = Z_DATA_ERROR;
+						case Z_DATA_ERROR:
+						case Z_MEM_ERROR:
+						case Z_STREAM_ERROR:
+							throw std::runtime_error( "Some error with deflate: " + util::toString( ret ) );
+					}
+					
+					unsigned int have = BUFFER_SIZE - stream.avail_out;
+					toReturn.append( reinterpret_cast< char* >( bufferOut ), have );
+				}
+				while ( stream.avail_out == 0 );
+				
+				if ( flush == Z_FULL_FLUSH )
+				{
+					Checkpoint checkpoint;
+					checkpoint.in = toReturn.length();
+					checkpoint.out = done;
+					checkpoints->push_back( checkpoint );
+					nextCheckpoint += options.checkpointSpacing;
+				}
+			}
+			while ( ret != Z_STREAM_END );
+			
+			return toReturn;
+		}
+		
+		sf::Uint16 makeDosDate( const struct tm& time )
+		{
+			sf::Uint16 date = 0;
+			date ^= static_cast< sf::Uint16 >( ( time.tm_year - 80 ) & 0x7F ) << 9;
+			date ^= static_cast< sf::Uint16 >( ( time.tm_mon  +  1 ) & 0x0F ) << 5;
+			date ^= static_cast< sf::Uint16 >( ( time.tm_mday +  0 ) & 0x1F ) << 0;
+			return date;
+		}
+		
+		sf::Uint16 makeDosTime( const struct tm& theTime )
+		{
+			sf::Uint16 time = 0;
+			time ^= static_cast< sf::Uint16 >( ( theTime.tm_hour + 0 ) & 0x1F ) << 11;
+			time ^= static_cast< sf::Uint16 >( ( theTime.tm_min  + 0 ) & 0x3F ) <<  5;
+			time ^= static_cast< sf::Uint16 >( ( theTime.tm_sec  / 2 ) & 0x1F ) <<  0;
+			return time;
+		}
+		
+		struct tm getLocalTime( std::time_t rawTime )
+		{
+			struct tm time = {};
+			#ifdef _WIN32
+			localtime_s( &time, &rawTime );
+			#else
+			localtime_r( &rawTime, &time );
+			#endif
+			
+			if ( time.tm_year < 80 )
+			{
+				time = {};
+				time.tm_year = 80;
+				time.tm_mday = 1;
+			}
+			
+			return time;
+		}
+		
+		struct tm readDosTime( sf::Uint16 date, sf::Uint16 time )
+		{
+			struct tm theTime = {};
+			theTime.tm_year = ( ( date >> 9 ) & 0x7F ) + 80;
+			theTime.tm_mon  = ( ( date >> 5 ) & 0x0F ) - 1;
+			theTime.tm_mday = ( ( date >> 0 ) & 0x1F );
+			theTime.tm_hour = ( ( time >> 11 ) & 0x1F );
+			theTime.tm_min  = ( ( time >>  5 ) & 0x3F );
+			theTime.tm_sec  = ( ( time >>  0 ) & 0x1F ) * 2;
+			theTime.tm_isdst = -1;
+			return theTime;
+		}
+		
+		CompressedFile compressFile( std::string_view contents, const std::string& filename, const struct tm& time, const CompressionOptions& options, Counters* counters )
+		{
+			CompressedFile file;
+			LocalFileHeader& lf = file.header;
+			lf.minVersion = 20; // Assuming this because I don't want to bother doing it properly :P
+			lf.flags = 0;
+			lf.compressType = Compression::Deflated;
+			
+			// TO DO: Use cstdtime somehow
+			lf.lastModTime = makeDosTime( time );
+			lf.lastModDate = makeDosDate( time );
+			
+			lf.crc32 = 0;
+			bool haveCrc = false;
+			Checkpoints checkpoints;
+			if ( options.method == CompressionOptions::Deflated and options.adaptive )
+			{
+				PhaseTimer timer( counters, Counters::DeflateTime ); // Often a small trial deflate
+				file.skipped = !isWorthDeflating( contents );
+			}
+			
+			if ( options.method == CompressionOptions::Deflated and !file.skipped )
+			{
+				file.data = getDeflated( contents, options, &lf.crc32, &checkpoints, counters );
+				lf.flags |= getDeflateFlags( options.level );
+				haveCrc = true;
+			}
+			
+			if ( options.method == CompressionOptions::Stored or file.skipped or file.data.length() >= contents.length() )
+			{
+				lf.flags = 0;
+				//lf.minVersion = 10;
+				lf.compressType = 0;
+				file.data.assign( contents.data(), contents.length() );
+			}
+			
+			if ( !haveCrc )
+			{
+				PhaseTimer timer( counters, Counters::CrcTime );
+				lf.crc32 = getCrc32( contents );//data/*, magicNumberCrc32*/ );
+			}
+			
+			lf.sizeCompressed = file.data.length();
+			lf.sizeNormal = contents.length();
+			if ( needsZip64( lf ) )
+			{
+				lf.minVersion = 45;
+			}
+			
+			lf.filename = filename;
+			lf.extra = ( lf.compressType == Compression::Deflated ) ? makeCheckpointExtra( checkpoints ) : "";
+			
+			return file;
+		}
+		
+		std::size_t getSize( const LocalFileHeader& lf )
+		{
+			std::size_t zip64 = needsZip64( lf ) ? 4 + 16 : 0;
+			return 30 + lf.filename.length() + zip64 + lf.extra.length();
+		}
+		
+		std::size_t getSize( const CentralDirectoryStructure& cd )
+		{
+			std::size_t count = getZip64Values( cd ).size();
+			std::size_t zip64 = ( count > 0 ) ? 4 + count * 8 : 0;
+			return 46 + cd.filename.length() + zip64 + cd.extra.length() + cd.comment.length();
+		}
+		
+		CentralDirectoryStructure makeCentralDir( const LocalFileHeader& lf, sf::Uint64 localHeaderOffset )
+		{
+			CentralDirectoryStructure cd;
+			cd.versionMade = 20;
+			
+			cd.minVersion = lf.minVersion;
+			cd.flags = lf.flags;
+			cd.compressType = lf.compressType;
+			
+			cd.lastModTime = lf.lastModTime;
+			cd.lastModDate = lf.lastModDate;
+			
+			cd.crc32 = lf.crc32;
+			
+			cd.sizeCompressed = lf.sizeCompressed;
+			cd.sizeNormal = lf.sizeNormal;
+			
+			cd.filename = lf.filename;
+			cd.extra = lf.extra;
+			
+			cd.comment = "";
+			
+			cd.diskNumStart = 0;//? i; // ?
+			cd.inAttr = 0;
+			cd.exAttr = 0;
+			cd.localHeaderOffset = localHeaderOffset;
+			
+			if ( !getZip64Values( cd ).empty() )
+			{
+				cd.versionMade = std::max< sf::Uint16 >( cd.versionMade, 45 );
+				cd.minVersion = std::max< sf::Uint16 >( cd.minVersion, 45 );
+			}
+			
+			return cd;
+		}
+		
+		bool readDirectory( const char* data, std::size_t size, EndCentralDirectoryStructure& ecd, std::vector< CentralDirectoryStructure >& cds, Counters* counters )
+		{
+			MemoryBuffer buffer( data, size );
+			std::istream ss( &buffer );
+			
+			#define streamCheck( a ) if ( !ss ) { throw std::runtime_error( "Stream error (maybe too short?) at " + std::string( a ) ); }
+			
+			std::size_t endCentralDirPos;
+			{
+				PhaseTimer timer( counters, Counters::EndCentralDirTime );
+				endCentralDirPos = findEndCentralDir( data, size );
+				if ( endCentralDirPos == std::string::npos )
+				{
+					return false;
+				}
+				ss.seekg( endCentralDirPos );
+				streamCheck( "ecd pos" );
+				
+				ecd = readEndCentralDir( ss );
+				streamCheck( "ecd" );
+				readZip64EndCentralDir( ss, endCentralDirPos, ecd );
+				ss.seekg( ecd.centralDirOffset );
+				streamCheck( "zip64 ecd" );
+			}
+			
+			// Everything from the central directory to the end
+			addCount( counters, Counters::BytesRead, size - std::min< sf::Uint64 >( ecd.centralDirOffset, size ) );
+			
+			// Every record is at least 46 bytes, so don't trust a count that couldn't fit
+			if ( ecd.entryCountDisk > ecd.centralDirSize / 46 or ecd.centralDirSize > size )
+			{
+				throw std::runtime_error( "Central directory can't hold " + util::toString( ecd.entryCountDisk ) + " entries." );
+			}
+			
+			PhaseTimer timer( counters, Counters::CentralDirTime );
+			cds.clear();
+			cds.reserve( ecd.entryCountDisk );
+			for ( sf::Uint64 i = 0; i < ecd.entryCountDisk; ++i )
+			{
+				CentralDirectoryStructure cd = readCentralDir( ss );
+				streamCheck( "cds" );
+				cds.push_back( cd );
+			}
+			
+			#undef streamCheck
+			
+			return true;
+		}
+		
+		void writeDirectory( std::ostream& ss, const std::vector< std::pair< LocalFileHeader, sf::Uint64 > >& lfs, sf::Uint64 centralDirOffset, const std::vector< CentralDirectoryStructure >& existing, const std::string& comment, Counters* counters )
+		{
+			sf::Uint64 centralDirSize = 0;
+			{
+				PhaseTimer timer( counters, Counters::CentralDirTime );
+				for ( std::size_t i = 0; i < existing.size(); ++i )
+				{
+					writeCentralDir( ss, existing[ i ] );
+					centralDirSize += getSize( existing[ i ] );
+				}
+				
+				for ( std::size_t i = 0; i < lfs.size(); ++i )
+				{
+					CentralDirectoryStructure cd = makeCentralDir( lfs[ i ].first, lfs[ i ].second );
+					writeCentralDir( ss, cd );
+					centralDirSize += getSize( cd );
+				}
+			}
+			
+			PhaseTimer timer( counters, Counters::EndCentralDirTime );
+			EndCentralDirectoryStructure ecd;
+			ecd.diskNum = 0;
+			ecd.diskNumStartCentralDirectory = 0;
+			
+			ecd.entryCountDisk = existing.size() + lfs.size();
+			ecd.entryCountCentral = existing.size() + lfs.size();
+			
+			ecd.centralDirSize = centralDirSize;
+			ecd.centralDirOffset = centralDirOffset;
+			
+			ecd.comment = comment.substr( 0, zip64Marker16 ); // Has to fit in 16 bits
+			
+			std::size_t endSize = writeZip64EndCentralDir( ss, ecd, centralDirOffset + centralDirSize ) + 22;
+			writeEndCentralDir( ss, ecd );
+			addCount( counters, Counters::BytesWritten, centralDirSize + endSize );
+		}
+	}
+}
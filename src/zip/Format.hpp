@@ -0,0 +1,362 @@
+#ifndef ZIP_FORMAT_HPP
+#define ZIP_FORMAT_HPP
+
+#include <ctime>
+#include <istream>
+#include <ostream>
+#include <SFML/Config.hpp>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <util/Endian.hpp>
+#include <utility>
+#include <vector>
+
+#include "zip/Checkpoints.hpp"
+#include "zip/CompressionOptions.hpp"
+#include "zip/Statistics.hpp"
+
+// The on-disk structures and the code to read and write them, shared by
+// File, Writer and anything else that has to speak zip.
+
+// TO DO: Organize this mess!
+
+// Why did they remove this? :(
+// I need a proper replacement
+// From SFML/Config.hpp
+#if defined(__m68k__) || defined(mc68000) || defined(_M_M68K) || (defined(__MIPS__) && defined(__MISPEB__)) || \
+    defined(__ppc__) || defined(__POWERPC__) || defined(_M_PPC) || defined(__sparc__) || defined(__hppa__)
+
+    // Big endian
+    #define SFML_ENDIAN_BIG
+
+#else
+
+    // Little endian
+    #define SFML_ENDIAN_LITTLE
+
+#endif
+
+namespace zip
+{
+	namespace priv
+	{
+		// Lets the stream-based readers work directly on an archive that is already
+		// in memory (or mapped), instead of copying it into a stringstream.
+		class MemoryBuffer : public std::streambuf
+		{
+			public:
+				MemoryBuffer( const char* data, std::size_t size )
+				{
+					char* begin = const_cast< char* >( data );
+					setg( begin, begin, begin + size );
+				}
+			
+			protected:
+				virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in )
+				{
+					off_type pos = off;
+					if ( dir == std::ios_base::cur )
+					{
+						pos += gptr() - eback();
+					}
+					else if ( dir == std::ios_base::end )
+					{
+						pos += egptr() - eback();
+					}
+					
+					return seekpos( pos, which );
+				}
+				
+				virtual pos_type seekpos( pos_type pos, std::ios_base::openmode which = std::ios_base::in )
+				{
+					if ( !( which & std::ios_base::in ) or pos < 0 or pos > egptr() - eback() )
+					{
+						return pos_type( off_type( -1 ) );
+					}
+					
+					setg( eback(), eback() + static_cast< off_type >( pos ), egptr() );
+					return pos;
+				}
+		};
+		
+		template< typename T >
+		T read( std::istream& ss )
+		{
+			T t;
+			ss.read( reinterpret_cast< char* >( &t ), sizeof( T ) );
+			
+			#ifdef SFML_ENDIAN_BIG
+			if ( sizeof( T ) > 1 )
+			{
+				t = util::swapBytes( t );
+			}
+			#endif
+			
+			return t;
+		}
+		template< typename T >
+		void write( std::ostream& ss, T t )
+		{
+			#ifdef SFML_ENDIAN_BIG
+			if ( sizeof( T ) > 1 )
+			{
+				t = util::swapBytes( t );
+			}
+			#endif
+			
+			ss.write( reinterpret_cast< char* >( &t ), sizeof( T ) );
+		}
+		
+		std::string readStr( std::istream& ss, std::size_t len );
+		void writeStr( std::ostream& ss, const std::string& str, std::size_t len );
+		
+		template< typename T >
+		std::string readStr( std::istream& ss )
+		{
+			T len = read< T >( ss );
+			return readStr( ss, len );
+		}
+		
+		template< typename T >
+		void writeStr( std::ostream& ss, const std::string& str )
+		{
+			write< T >( ss, str.length() );
+			writeStr( ss, str, str.length() );
+		}
+		
+		template< sf::Uint16 N >
+		struct Signature
+		{
+			static const sf::Uint16 SIGNATURE;
+		};
+		template< sf::Uint16 N >
+		const sf::Uint16 Signature< N >::SIGNATURE = N;
+		
+		// 4.3.7
+		struct LocalFileHeaderBase
+		{
+			sf::Uint16 minVersion;
+			sf::Uint16 flags;
+			sf::Uint16 compressType;
+			
+			sf::Uint16 lastModTime;
+			sf::Uint16 lastModDate;
+			
+			sf::Uint32 crc32;
+			
+			sf::Uint64 sizeCompressed; // sf::Uint32, or in the Zip64 extra field
+			sf::Uint64 sizeNormal; // sf::Uint32, or in the Zip64 extra field
+			
+			std::string filename; // sf::Uint16 filenameLength
+			std::string extra; // sf::Uint16 extraLength, minus the Zip64 field (that's handled while reading/writing)
+			
+			bool zip64 = false; // Whether the Zip64 field was there, or should be regardless of the sizes
+		};
+		
+		struct LocalFileHeader : LocalFileHeaderBase, Signature< 0x0304 >
+		{
+		};
+		
+		// 4.3.9
+		struct DataDescriptor : Signature< 0x0708 >
+		{
+			sf::Uint32 crc32; // ?
+			
+			sf::Uint64 sizeCompressed; // sf::Uint64 if the local header had a Zip64 field
+			sf::Uint64 sizeNormal; // Likewise
+		};
+		
+		// 4.3.11
+		struct ArchiveExtraData : Signature< 0x0608 >
+		{
+			std::string extra; // sf::Uint32 extraLength
+		};
+		
+		// 4.3.12
+		struct CentralDirectoryStructure : LocalFileHeaderBase, Signature< 0x0102 >
+		{
+			sf::Uint16 versionMade;
+			
+			// LocalFileHeaderBase stuff here, except filename/extra
+			
+			std::string comment; // sf::Uint16 commentLength here, comment at the bottom
+			
+			sf::Uint16 diskNumStart;
+			sf::Uint16 inAttr;
+			sf::Uint32 exAttr;
+			sf::Uint64 localHeaderOffset; // sf::Uint32, or in the Zip64 extra field
+			
+			// LocalFileHeaderBase filename/extra here
+		};
+		
+		// 4.3.13
+		struct DigitalSignature : Signature< 0x0505 >
+		{
+			std::string data; // sf::Uint16 size
+		};
+		
+		// 4.3.16
+		struct EndCentralDirectoryStructure : Signature< 0x0506 >
+		{
+			sf::Uint16 diskNum;
+			sf::Uint16 diskNumStartCentralDirectory; // What is this? :P
+			
+			sf::Uint64 entryCountDisk; // sf::Uint16, or in the Zip64 record
+			sf::Uint64 entryCountCentral; // Likewise
+			
+			sf::Uint64 centralDirSize; // sf::Uint32, or in the Zip64 record
+			sf::Uint64 centralDirOffset; // Likewise
+			
+			std::string comment; // sf::Uint16 commentLength
+		};
+		
+		// 4.3.14, only the parts we need; the rest go in the regular record
+		struct Zip64EndCentralDirectoryStructure : Signature< 0x0606 >
+		{
+		};
+		
+		// 4.3.15
+		struct Zip64EndCentralDirectoryLocator : Signature< 0x0607 >
+		{
+			sf::Uint32 diskNum;
+			sf::Uint64 endCentralDirOffset;
+			sf::Uint32 diskCount;
+		};
+		
+		// 4.5.3
+		const sf::Uint16 zip64ExtraId = 0x0001;
+		const sf::Uint32 zip64Marker = 0xFFFFFFFF;
+		const sf::Uint16 zip64Marker16 = 0xFFFF;
+		
+		namespace Flags
+		{
+			// 4.4.4
+			enum General : sf::Uint16
+			{
+				Encrypted =               1 << 0,
+				CompressionFlag1 =        1 << 1,
+				CompressionFlag2 =        1 << 2,
+				DataDescriptorPostponed = 1 << 3,
+				ReservedForDeflation =    1 << 4,
+				UsesPatchedData =         1 << 5, // ?
+				StrongEncryption =        1 << 6,
+				LanguageEncoded =         1 << 11,
+				ReservedByPkware12 =      1 << 12,
+				SomeValuesMasked =        1 << 13, // For strong encryption
+				ReservedByPkware14 =      1 << 14,
+				ReservedByPkware15 =      1 << 15,
+			};
+		}
+		
+		namespace Compression
+		{
+			// 4.4.5
+			enum CompressionMethod : sf::Uint16
+			{
+				None = 0,
+				Shrunk = 1,
+				Reduced1 = 2,
+				Reduced2 = 3,
+				Reduced3 = 4,
+				Reduced4 = 5,
+				Imploded = 6,
+				ReservedForTokenizing = 7,
+				Deflated = 8,
+				EnhancedDeflate64 = 9,
+				PkwareImploding = 10,
+				ReservedByPkware11 = 11,
+				BZip2 = 12,
+				ReservedByPkware13 = 13,
+				Lzma = 14,
+				ReservedByPkware15 = 15,
+				ReservedByPkware16 = 16,
+				ReservedByPkware17 = 17,
+				IbmTerse = 18,
+				IbmLz77 = 19,
+				WavPack = 97,
+				Ppmd = 98,
+			};
+		}
+		
+		// 4.4.7
+		const sf::Uint32 magicNumberCrc32 = 0xe320bbde;
+		
+		std::string makeSig( sf::Uint16 sig );
+		
+		// Removes the field with this id from an extra block, and gives back its data
+		bool takeExtraField( std::string& extra, sf::Uint16 id, std::string& field );
+		std::size_t findEndCentralDir( const char* data, std::size_t size );
+		
+		EndCentralDirectoryStructure readEndCentralDir( std::istream& ss );
+		void writeEndCentralDir( std::ostream& ss, EndCentralDirectoryStructure& ecd );
+		
+		// If there's a Zip64 locator right before the end record at endCentralDirPos,
+		// fills in ecd from the Zip64 record it points to.
+		bool readZip64EndCentralDir( std::istream& ss, std::size_t endCentralDirPos, EndCentralDirectoryStructure& ecd );
+		
+		// Writes the Zip64 record and locator that have to come before writeEndCentralDir(),
+		// if ecd has anything that doesn't fit without them.
+		std::size_t writeZip64EndCentralDir( std::ostream& ss, const EndCentralDirectoryStructure& ecd, sf::Uint64 endCentralDirOffset );
+		
+		void readLocalFileHeaderBase( std::istream& ss, LocalFileHeaderBase& lfh );
+		void writeLocalFileHeaderBase( std::ostream& ss, const LocalFileHeaderBase& lfh, bool maskBothSizes );
+		
+		CentralDirectoryStructure readCentralDir( std::istream& ss );
+		void writeCentralDir( std::ostream& ss, const CentralDirectoryStructure& cd );
+		
+		LocalFileHeader readLocalFileHeader( std::istream& ss );
+		void writeLocalFileHeader( std::ostream& ss, const LocalFileHeader& lf );
+		
+		// How many bytes the write functions above will produce
+		std::size_t getSize( const LocalFileHeader& lf );
+		std::size_t getSize( const CentralDirectoryStructure& cd );
+		
+		// For when we don't know how big anything is; leaves ss right after the deflated data
+		void readAndInflate( std::istream& ss, std::string& contents );
+		
+		// For when we do: all at once, straight into a buffer of the right size.
+		// Throws std::runtime_error if data doesn't inflate to exactly size bytes.
+		// Both update crc (if given) with the uncompressed data as they go.
+		// getDeflated() also fills in checkpoints (if given) when options asks
+		// for them. Anything taking counters can be given NULL to skip keeping
+		// track.
+		std::string getInflated( std::string_view data, sf::Uint64 size, sf::Uint32* crc = NULL, Counters* counters = NULL );
+		
+		// Sizes come from the archive, so they can't be trusted with an
+		// allocation; this throws std::runtime_error if size is more than
+		// data could possibly inflate to (deflate tops out around 1032:1).
+		void checkInflatedSize( std::string_view data, sf::Uint64 size );
+		std::string getDeflated( std::string_view contents, const CompressionOptions& options, sf::Uint32* crc = NULL, Checkpoints* checkpoints = NULL, Counters* counters = NULL );
+		
+		sf::Uint16 makeDosDate( const struct tm& time );
+		sf::Uint16 makeDosTime( const struct tm& theTime );
+		struct tm readDosTime( sf::Uint16 date, sf::Uint16 time ); // Local time, with tm_isdst left for mktime() to work out
+		struct tm getLocalTime( std::time_t rawTime ); // Thread-safe, and no earlier than 1980, which is as far back as zip times go
+		
+		struct CompressedFile
+		{
+			LocalFileHeader header;
+			std::string data;
+			bool skipped = false; // Stored without even trying deflate, see CompressionOptions::adaptive
+		};
+		
+		// Safe to call from several threads at once
+		CompressedFile compressFile( std::string_view contents, const std::string& filename, const struct tm& time, const CompressionOptions& options, Counters* counters = NULL );
+		CentralDirectoryStructure makeCentralDir( const LocalFileHeader& lf, sf::Uint64 localHeaderOffset );
+		
+		// Finds the end record (and the Zip64 one, if any) and reads the whole
+		// central directory it points to. Returns false if there's no end
+		// record, and throws std::runtime_error if anything after that is off.
+		bool readDirectory( const char* data, std::size_t size, EndCentralDirectoryStructure& ecd, std::vector< CentralDirectoryStructure >& cds, Counters* counters = NULL );
+		
+		// Writes the central directory and end record for files whose local
+		// headers were already written, given where they were written to and
+		// where the central directory starts. Doesn't need a seekable stream.
+		// Anything in existing (entries already in the archive being appended
+		// to) goes first, as it is.
+		void writeDirectory( std::ostream& ss, const std::vector< std::pair< LocalFileHeader, sf::Uint64 > >& lfs, sf::Uint64 centralDirOffset, const std::vector< CentralDirectoryStructure >& existing = std::vector< CentralDirectoryStructure >(), const std::string& comment = "", Counters* counters = NULL );
+	}
+}
+
+#endif // ZIP_FORMAT_HPP
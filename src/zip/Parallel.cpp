@@ -0,0 +1,164 @@
+#include "zip/Parallel.hpp"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zip
+{
+	namespace priv
+	{
+		unsigned int getThreadCount( unsigned int requested )
+		{
+			if ( requested == 0 )
+			{
+				requested = std::thread::hardware_concurrency();
+			}
+			
+			return ( requested == 0 ) ? 1 : requested;
+		}
+		
+		void parallelFor( std::size_t count, unsigned int threads, const std::function< void( std::size_t ) >& func )
+		{
+			threads = getThreadCount( threads );
+			if ( threads > count )
+			{
+				threads = count;
+			}
+			
+			if ( threads <= 1 )
+			{
+				for ( std::size_t i = 0; i < count; ++i )
+				{
+					func( i );
+				}
+				return;
+			}
+			
+			std::atomic< std::size_t > next( 0 );
+			std::atomic< bool > failed( false );
+			std::exception_ptr exception;
+			std::mutex exceptionMutex;
+			
+			auto work = [ & ]()
+			{
+				while ( !failed )
+				{
+					std::size_t i = next++;
+					if ( i >= count )
+					{
+						break;
+					}
+					
+					try
+					{
+						func( i );
+					}
+					catch ( ... )
+					{
+						std::lock_guard< std::mutex > lock( exceptionMutex );
+						if ( !exception )
+						{
+							exception = std::current_exception();
+						}
+						failed = true;
+					}
+				}
+			};
+			
+			std::vector< std::thread > workers;
+			workers.reserve( threads - 1 );
+			for ( unsigned int i = 1; i < threads; ++i )
+			{
+				workers.emplace_back( work );
+			}
+			work();
+			
+			for ( std::size_t i = 0; i < workers.size(); ++i )
+			{
+				workers[ i ].join();
+			}
+			
+			if ( exception )
+			{
+				std::rethrow_exception( exception );
+			}
+		}
+		
+		ThreadPool::ThreadPool( unsigned int threads )
+		   : running( 0 ),
+		     stopping( false )
+		{
+			threads = getThreadCount( threads );
+			workers.reserve( threads );
+			for ( unsigned int i = 0; i < threads; ++i )
+			{
+				workers.emplace_back( &ThreadPool::work, this );
+			}
+		}
+		
+		ThreadPool::~ThreadPool()
+		{
+			{
+				std::lock_guard< std::mutex > lock( mutex );
+				stopping = true;
+			}
+			ready.notify_all();
+			
+			for ( std::size_t i = 0; i < workers.size(); ++i )
+			{
+				workers[ i ].join();
+			}
+		}
+		
+		void ThreadPool::post( std::function< void() > job )
+		{
+			{
+				std::lock_guard< std::mutex > lock( mutex );
+				jobs.push_back( std::move( job ) );
+			}
+			ready.notify_one();
+		}
+		
+		void ThreadPool::wait()
+		{
+			std::unique_lock< std::mutex > lock( mutex );
+			idle.wait( lock, [ this ]() { return jobs.empty() and running == 0; } );
+		}
+		
+		void ThreadPool::work()
+		{
+			std::unique_lock< std::mutex > lock( mutex );
+			while ( true )
+			{
+				ready.wait( lock, [ this ]() { return stopping or !jobs.empty(); } );
+				if ( jobs.empty() )
+				{
+					return; // Stopping, and nothing left to do
+				}
+				
+				std::function< void() > job = std::move( jobs.front() );
+				jobs.pop_front();
+				++running;
+				lock.unlock();
+				
+				try
+				{
+					job();
+				}
+				catch ( ... )
+				{
+				}
+				
+				lock.lock();
+				--running;
+				if ( jobs.empty() and running == 0 )
+				{
+					idle.notify_all();
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef ZIP_PARALLEL_HPP
+#define ZIP_PARALLEL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zip
+{
+	namespace priv
+	{
+		// 0 means one per core
+		unsigned int getThreadCount( unsigned int requested );
+		
+		// Calls func( i ) for every i in [0, count), spread over up to
+		// threads threads (the calling thread included). If any call
+		// throws, the remaining work is skipped and the first exception is
+		// rethrown here once everything has stopped.
+		void parallelFor( std::size_t count, unsigned int threads, const std::function< void( std::size_t ) >& func );
+		
+		// Threads that work through jobs as they're posted, for when the work
+		// doesn't all exist up front. Jobs shouldn't throw; anything that does
+		// is dropped. The destructor finishes everything posted first.
+		class ThreadPool
+		{
+			public:
+				ThreadPool( unsigned int threads ); // 0 means one per core
+				~ThreadPool();
+				
+				ThreadPool( const ThreadPool& other ) = delete;
+				ThreadPool& operator = ( const ThreadPool& other ) = delete;
+				
+				void post( std::function< void() > job );
+				void wait(); // Until nothing is queued or running
+			
+			private:
+				std::mutex mutex;
+				std::condition_variable ready;
+				std::condition_variable idle;
+				std::deque< std::function< void() > > jobs;
+				std::size_t running;
+				bool stopping;
+				std::vector< std::thread > workers;
+				
+				void work();
+		};
+	}
+}
+
+#endif // ZIP_PARALLEL_HPP
@@ -0,0 +1,292 @@
+#include "zip/Reader.hpp"
+
+#include <stdexcept>
+#include <util/String.hpp>
+#include <zlib.h>
+
+#include "zip/Format.hpp"
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+using namespace zip::priv;
+
+namespace
+{
+	constexpr std::size_t CHUNK_SIZE = 65536;
+	
+	sf::Uint16 getUint16( const char* data )
+	{
+		const unsigned char* bytes = reinterpret_cast< const unsigned char* >( data );
+		return bytes[ 0 ] | ( bytes[ 1 ] << 8 );
+	}
+	
+	sf::Uint32 getUint32( const char* data )
+	{
+		return getUint16( data ) | ( static_cast< sf::Uint32 >( getUint16( data + 2 ) ) << 16 );
+	}
+	
+	sf::Uint64 getUint64( const char* data )
+	{
+		return getUint32( data ) | ( static_cast< sf::Uint64 >( getUint32( data + 4 ) ) << 32 );
+	}
+}
+
+namespace zip
+{
+	Reader::Reader( std::istream& theStream )
+	   : stream( theStream ),
+	     pos( 0 ),
+	     done( false ),
+	     good( true )
+	{
+	}
+	
+	bool Reader::next( std::string& path, std::string& contents )
+	{
+		if ( done or !good )
+		{
+			return false;
+		}
+		
+		try
+		{
+			if ( !fill( 4 ) )
+			{
+				throw std::runtime_error( "Archive ended before the central directory." );
+			}
+			
+			// Anything after the last entry means we're done
+			std::string sig = buffer.substr( pos, 4 );
+			if ( sig == makeSig( CentralDirectoryStructure::SIGNATURE ) or sig == makeSig( EndCentralDirectoryStructure::SIGNATURE ) or
+			     sig == makeSig( ArchiveExtraData::SIGNATURE ) or sig == makeSig( DigitalSignature::SIGNATURE ) )
+			{
+				done = true;
+				return false;
+			}
+			else if ( sig != makeSig( LocalFileHeader::SIGNATURE ) )
+			{
+				throw std::runtime_error( "Unexpected signature in the middle of the archive." );
+			}
+			
+			// 4.3.7: The name and extra lengths are the last thing before them.
+			// The header is skipped by what's actually there, since working it
+			// out again from lf gets it wrong whenever the Zip64 field was
+			// there without being needed (or was a different size).
+			if ( !fill( 30 ) )
+			{
+				throw std::runtime_error( "Archive ended in a local file header." );
+			}
+			std::size_t headerSize = 30 + getUint16( &buffer[ pos + 26 ] ) + getUint16( &buffer[ pos + 28 ] );
+			if ( !fill( headerSize ) )
+			{
+				throw std::runtime_error( "Archive ended in a local file header." );
+			}
+			
+			MemoryBuffer header( buffer.data() + pos, buffer.length() - pos );
+			std::istream ss( &header );
+			LocalFileHeader lf = readLocalFileHeader( ss );
+			pos += headerSize;
+			
+			contents.clear();
+			if ( lf.compressType == Compression::Deflated and !( lf.flags & Flags::DataDescriptorPostponed ) )
+			{
+				// Sizes are right there, so it can all go at once
+				if ( !fill( lf.sizeCompressed ) )
+				{
+					throw std::runtime_error( "Archive ended in the data for " + lf.filename + "." );
+				}
+				
+				contents = getInflated( std::string_view( buffer ).substr( pos, lf.sizeCompressed ), lf.sizeNormal );
+				pos += lf.sizeCompressed;
+			}
+			else if ( lf.compressType == Compression::Deflated )
+			{
+				inflate( contents );
+			}
+			else if ( lf.compressType == Compression::None )
+			{
+				std::size_t size = lf.sizeCompressed;
+				if ( lf.flags & Flags::DataDescriptorPostponed )
+				{
+					// Nothing marks where stored data ends, so look for a
+					// descriptor (with its signature) that says it's as big
+					// as the distance to it.
+					std::string descriptor = makeSig( DataDescriptor::SIGNATURE );
+					for ( size = 0; ; ++size )
+					{
+						if ( !fill( size + ( lf.zip64 ? 24 : 16 ) ) )
+						{
+							throw std::runtime_error( "Couldn't find the data descriptor for " + lf.filename + "." );
+						}
+						
+						const char* sizeField = &buffer[ pos + size + 8 ];
+						if ( buffer.compare( pos + size, 4, descriptor ) == 0 and ( lf.zip64 ? getUint64( sizeField ) : getUint32( sizeField ) ) == size )
+						{
+							break;
+						}
+					}
+				}
+				
+				if ( !fill( size ) )
+				{
+					throw std::runtime_error( "Archive ended in the data for " + lf.filename + "." );
+				}
+				
+				contents = buffer.substr( pos, size );
+				pos += size;
+			}
+			else
+			{
+				throw std::runtime_error( "Unsupported compression type " + util::toString( lf.compressType ) + " for file " + lf.filename + "." );
+			}
+			
+			// 4.3.9: The signature is optional, so it might be the CRC instead.
+			// The sizes are 8 bytes each if there was a Zip64 field.
+			if ( lf.flags & Flags::DataDescriptorPostponed )
+			{
+				if ( !fill( 4 ) )
+				{
+					throw std::runtime_error( "Archive ended in a data descriptor." );
+				}
+				
+				std::size_t size = ( lf.zip64 ? 20 : 12 );
+				if ( buffer.compare( pos, 4, makeSig( DataDescriptor::SIGNATURE ) ) == 0 )
+				{
+					size += 4;
+				}
+				if ( !fill( size ) )
+				{
+					throw std::runtime_error( "Archive ended in a data descriptor." );
+				}
+				pos += size;
+			}
+			
+			path = lf.filename;
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error reading zip stream, exception: " << exception.what() << std::endl );
+			good = false;
+			return false;
+		}
+		
+		return true;
+	}
+	
+	bool Reader::readAll( const Callback& callback )
+	{
+		std::string path;
+		std::string contents;
+		while ( next( path, contents ) )
+		{
+			callback( path, contents );
+		}
+		
+		return good;
+	}
+	
+	bool Reader::isGood() const
+	{
+		return good;
+	}
+	
+	bool Reader::fill( std::size_t count )
+	{
+		if ( buffer.length() - pos >= count )
+		{
+			return true;
+		}
+		
+		// Drop what's already been used so the buffer doesn't grow with the archive
+		buffer.erase( 0, pos );
+		pos = 0;
+		
+		while ( buffer.length() < count )
+		{
+			std::size_t old = buffer.length();
+			std::size_t want = std::max( count - old, CHUNK_SIZE );
+			buffer.resize( old + want );
+			stream.read( &buffer[ old ], want );
+			buffer.resize( old + stream.gcount() );
+			
+			if ( stream.gcount() == 0 )
+			{
+				return false;
+			}
+		}
+		
+		return true;
+	}
+	
+	void Reader::inflate( std::string& contents )
+	{
+		z_stream zs;
+		zs.zalloc = Z_NULL;
+		zs.zfree = Z_NULL;
+		zs.opaque = Z_NULL;
+		zs.next_in = Z_NULL;
+		zs.avail_in = 0;
+		
+		int ret = inflateInit2( &zs, -15 ); // Raw deflate data, see readAndInflate()
+		if ( ret != Z_OK )
+		{
+			throw std::runtime_error( "Failed to init zlib inflate." );
+		}
+		
+		class InflateEnder
+		{
+			public:
+				InflateEnder( z_stream& theStream )
+				   : stream( theStream )
+				{
+				}
+				
+				~InflateEnder()
+				{
+					inflateEnd( &stream );
+				}
+			
+			private:
+				z_stream& stream;
+		} ie( zs );
+		
+		// Whatever the stream doesn't consume stays in the buffer for the next record
+		char bufferOut[ CHUNK_SIZE ];
+		do
+		{
+			if ( pos == buffer.length() and !fill( 1 ) )
+			{
+				throw std::runtime_error( "Archive ended in the middle of deflated data." );
+			}
+			
+			zs.next_in = reinterpret_cast< Bytef* >( &buffer[ pos ] );
+			zs.avail_in = buffer.length() - pos;
+			zs.next_out = reinterpret_cast< Bytef* >( bufferOut );
+			zs.avail_out = CHUNK_SIZE;
+			
+			ret = ::inflate( &zs, Z_NO_FLUSH );
+			switch ( ret )
+			{
+				case Z_NEED_DICT:
+				case Z_DATA_ERROR:
+					throw std::runtime_error( "Data error with inflate: " + util::toString( ret ) );
+					
+				case Z_MEM_ERROR:
+					throw std::runtime_error( "Memory error with inflate: " + util::toString( ret ) );
+					
+				case Z_STREAM_ERROR:
+					throw std::runtime_error( "Stream error with inflate: " + util::toString( ret ) );
+			}
+			
+			pos = buffer.length() - zs.avail_in;
+			contents.append( bufferOut, CHUNK_SIZE - zs.avail_out );
+		}
+		while ( ret != Z_STREAM_END );
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef ZIP_READER_HPP
+#define ZIP_READER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <string>
+
+namespace zip
+{
+	// Reads an archive front to back from a stream that can't seek (a pipe,
+	// a socket...), by walking the local file headers instead of the central
+	// directory. Each entry is handed over as soon as it has been inflated,
+	// so only one entry is ever held in memory.
+	class Reader
+	{
+		public:
+			// Directories come through with a trailing '/' and no contents
+			typedef std::function< void( const std::string& path, const std::string& contents ) > Callback;
+			
+			Reader( std::istream& theStream );
+			
+			Reader( const Reader& other ) = delete;
+			Reader& operator = ( const Reader& other ) = delete;
+			
+			// False once the central directory is reached, or on an error (see isGood())
+			bool next( std::string& path, std::string& contents );
+			bool readAll( const Callback& callback );
+			
+			bool isGood() const;
+		
+		private:
+			std::istream& stream;
+			
+			// Read from the stream but not used yet
+			std::string buffer;
+			std::size_t pos;
+			
+			bool done;
+			bool good;
+			
+			bool fill( std::size_t count );
+			void inflate( std::string& contents );
+	};
+}
+
+#endif // ZIP_READER_HPP
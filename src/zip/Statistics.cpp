@@ -0,0 +1,45 @@
+#include "zip/Statistics.hpp"
+
+namespace zip
+{
+	namespace priv
+	{
+		Counters::Counters()
+		{
+			reset();
+		}
+		
+		void Counters::add( Counter counter, sf::Uint64 amount )
+		{
+			// Nothing reads these until the load or save is over
+			values[ counter ].fetch_add( amount, std::memory_order_relaxed );
+		}
+		
+		void Counters::reset()
+		{
+			for ( std::atomic< sf::Uint64 >& value : values )
+			{
+				value.store( 0, std::memory_order_relaxed );
+			}
+		}
+		
+		Statistics Counters::get() const
+		{
+			Statistics stats;
+			stats.bytesRead = values[ BytesRead ].load();
+			stats.bytesWritten = values[ BytesWritten ].load();
+			stats.entries = values[ Entries ].load();
+			stats.compressedBytes = values[ CompressedBytes ].load();
+			stats.uncompressedBytes = values[ UncompressedBytes ].load();
+			stats.allocations = values[ Allocations ].load();
+			stats.endCentralDirTime = values[ EndCentralDirTime ].load();
+			stats.centralDirTime = values[ CentralDirTime ].load();
+			stats.localHeaderTime = values[ LocalHeaderTime ].load();
+			stats.inflateTime = values[ InflateTime ].load();
+			stats.deflateTime = values[ DeflateTime ].load();
+			stats.crcTime = values[ CrcTime ].load();
+			stats.treeTime = values[ TreeTime ].load();
+			return stats;
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef ZIP_STATISTICS_HPP
+#define ZIP_STATISTICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <SFML/Config.hpp>
+
+namespace zip
+{
+	// What a load or save did, for finding out where the time went. Times
+	// are in nanoseconds. Phases that run on several threads add up every
+	// thread's time, so they can come to more than the wall clock.
+	struct Statistics
+	{
+		sf::Uint64 bytesRead = 0; // Out of the archive: the directory, plus local headers and data for each entry loaded
+		sf::Uint64 bytesWritten = 0;
+		sf::Uint64 entries = 0;
+		sf::Uint64 compressedBytes = 0;
+		sf::Uint64 uncompressedBytes = 0;
+		sf::Uint64 allocations = 0; // Entry and path blocks, and buffers for entry data; not every little string
+		
+		sf::Uint64 endCentralDirTime = 0; // Finding and reading the end records, or writing them
+		sf::Uint64 centralDirTime = 0;
+		sf::Uint64 localHeaderTime = 0;
+		sf::Uint64 inflateTime = 0;
+		sf::Uint64 deflateTime = 0;
+		sf::Uint64 crcTime = 0;
+		sf::Uint64 treeTime = 0; // Adding entries to the tree and the path index
+	};
+	
+	namespace priv
+	{
+		// Where a Statistics gets filled in from, by however many threads
+		class Counters
+		{
+			public:
+				enum Counter
+				{
+					BytesRead,
+					BytesWritten,
+					Entries,
+					CompressedBytes,
+					UncompressedBytes,
+					Allocations,
+					EndCentralDirTime,
+					CentralDirTime,
+					LocalHeaderTime,
+					InflateTime,
+					DeflateTime,
+					CrcTime,
+					TreeTime,
+					Count,
+				};
+				
+				Counters();
+				
+				void add( Counter counter, sf::Uint64 amount );
+				void reset();
+				Statistics get() const;
+			
+			private:
+				std::atomic< sf::Uint64 > values[ Count ];
+		};
+		
+		// Adds how long it was alive to one of the counters. Does nothing
+		// (not even look at the clock) if counters is NULL, which is what
+		// everything gets when statistics are off.
+		class PhaseTimer
+		{
+			public:
+				PhaseTimer( Counters* theCounters, Counters::Counter theCounter )
+				   : counters( theCounters ),
+				     counter( theCounter )
+				{
+					if ( counters != NULL )
+					{
+						start = std::chrono::steady_clock::now();
+					}
+				}
+				
+				~PhaseTimer()
+				{
+					if ( counters != NULL )
+					{
+						counters->add( counter, std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - start ).count() );
+					}
+				}
+				
+				PhaseTimer( const PhaseTimer& other ) = delete;
+				PhaseTimer& operator = ( const PhaseTimer& other ) = delete;
+			
+			private:
+				Counters* counters;
+				Counters::Counter counter;
+				std::chrono::steady_clock::time_point start;
+		};
+		
+		inline void addCount( Counters* counters, Counters::Counter counter, sf::Uint64 amount )
+		{
+			if ( counters != NULL )
+			{
+				counters->add( counter, amount );
+			}
+		}
+	}
+}
+
+#endif // ZIP_STATISTICS_HPP
@@ -0,0 +1,191 @@
+#include "zip/Writer.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "zip/ArchiveBuffer.hpp"
+#include "zip/Format.hpp"
+
+#if false
+	#include <iostream>
+	
+	#define print(a) std::cout << a << std::endl
+#else
+	#define print(a)
+#endif
+
+namespace zip
+{
+	Writer::Writer()
+	   : out( NULL ),
+	     offset( 0 ),
+	     skippedBytes( 0 )
+	{
+	}
+	
+	Writer::~Writer()
+	{
+		finish();
+	}
+	
+	bool Writer::open( const std::string& filename )
+	{
+		finish();
+		
+		file.reset( new std::fstream( filename.c_str(), std::fstream::out | std::fstream::trunc | std::fstream::binary ) );
+		if ( !( * file ) )
+		{
+			file.reset();
+			return false;
+		}
+		
+		out = file.get();
+		skippedBytes = 0;
+		return true;
+	}
+	
+	void Writer::open( std::ostream& stream )
+	{
+		finish();
+		
+		out = &stream;
+		skippedBytes = 0;
+	}
+	
+	bool Writer::append( const std::string& filename )
+	{
+		finish();
+		
+		priv::EndCentralDirectoryStructure ecd;
+		try
+		{
+			// Mapped, so only the pages with the central directory are read
+			{
+				priv::ArchiveBuffer archive;
+				if ( ( !archive.map( filename ) and !archive.read( filename ) ) or !priv::readDirectory( archive.getData(), archive.getSize(), ecd, existing ) )
+				{
+					existing.clear();
+					return false;
+				}
+			}
+			
+			file.reset( new std::fstream( filename.c_str(), std::fstream::in | std::fstream::out | std::fstream::binary ) );
+			file->seekp( ecd.centralDirOffset );
+			if ( !( * file ) )
+			{
+				throw std::runtime_error( "Couldn't open " + filename + " for writing." );
+			}
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error opening zip file to append to, exception: " << exception.what() << std::endl );
+			file.reset();
+			existing.clear();
+			return false;
+		}
+		
+		out = file.get();
+		offset = ecd.centralDirOffset;
+		comment = ecd.comment;
+		appendFilename = filename;
+		skippedBytes = 0;
+		return true;
+	}
+	
+	bool Writer::addFile( const std::string& path, std::string_view contents, const CompressionOptions& compression )
+	{
+		if ( out == NULL )
+		{
+			return false;
+		}
+		
+		try
+		{
+			priv::CompressedFile compressed = priv::compressFile( contents, path, priv::getLocalTime( std::time( NULL ) ), compression );
+			
+			priv::writeLocalFileHeader( * out, compressed.header );
+			out->write( compressed.data.c_str(), compressed.data.length() );
+			if ( !( * out ) )
+			{
+				throw std::runtime_error( "Stream error while writing " + path + "." );
+			}
+			
+			lfs.push_back( std::make_pair( compressed.header, offset ) );
+			offset += priv::getSize( compressed.header ) + compressed.data.length();
+			skippedBytes += compressed.skipped ? compressed.data.length() : 0;
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error writing zip entry, exception: " << exception.what() << std::endl );
+			return false;
+		}
+		
+		return true;
+	}
+	
+	bool Writer::finish()
+	{
+		if ( out == NULL )
+		{
+			return false;
+		}
+		
+		bool success = true;
+		try
+		{
+			// Anything we added again replaces what was there
+			std::unordered_set< std::string > added;
+			for ( std::size_t i = 0; i < lfs.size() and !existing.empty(); ++i )
+			{
+				added.insert( lfs[ i ].first.filename );
+			}
+			existing.erase( std::remove_if( existing.begin(), existing.end(), [ & ]( const priv::CentralDirectoryStructure& cd )
+			{
+				return added.count( cd.filename ) > 0;
+			} ), existing.end() );
+			
+			priv::writeDirectory( * out, lfs, offset, existing, comment );
+			out->flush();
+			if ( !( * out ) )
+			{
+				throw std::runtime_error( "Stream error while writing the central directory." );
+			}
+			
+			// The old directory (and comment) could've gone on longer than
+			// what replaced it, and a stale end record there would be found
+			// before ours.
+			if ( !appendFilename.empty() )
+			{
+				std::streamoff end = out->tellp();
+				file.reset();
+				if ( std::filesystem::file_size( appendFilename ) > static_cast< std::uintmax_t >( end ) )
+				{
+					std::filesystem::resize_file( appendFilename, end );
+				}
+			}
+		}
+		catch ( std::exception& exception )
+		{
+			print( "Error finishing zip file, exception: " << exception.what() << std::endl );
+			success = false;
+		}
+		
+		file.reset();
+		out = NULL;
+		offset = 0;
+		lfs.clear();
+		existing.clear();
+		comment.clear();
+		appendFilename.clear();
+		
+		return success;
+	}
+	
+	sf::Uint64 Writer::getSkippedBytes() const
+	{
+		return skippedBytes;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef ZIP_WRITER_HPP
+#define ZIP_WRITER_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <SFML/Config.hpp>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "zip/CompressionOptions.hpp"
+
+namespace zip
+{
+	namespace priv
+	{
+		struct CentralDirectoryStructure;
+		struct LocalFileHeader;
+	}
+	
+	// Writes an archive one entry at a time, straight to a file or stream,
+	// instead of building the whole thing in memory like File::saveToMemory.
+	// Only the entry currently being compressed is held on to.
+	class Writer
+	{
+		public:
+			Writer();
+			~Writer(); // Calls finish() if you didn't
+			
+			Writer( const Writer& other ) = delete;
+			Writer& operator = ( const Writer& other ) = delete;
+			
+			bool open( const std::string& filename );
+			void open( std::ostream& stream ); // Doesn't need to be seekable
+			
+			// Opens an existing archive and adds to the end of it. Only the
+			// central directory is read; new entries are written over it, and
+			// a new one goes after them, keeping the archive's comment. Adding
+			// a path that's already there replaces it (the old data just
+			// becomes unreachable).
+			bool append( const std::string& filename );
+			
+			bool addFile( const std::string& path, std::string_view contents, const CompressionOptions& compression = CompressionOptions() );
+			
+			// Writes the central directory. Nothing can be added after this.
+			bool finish();
+			
+			// How many bytes were stored without trying deflate on them since
+			// open(), thanks to CompressionOptions::adaptive
+			sf::Uint64 getSkippedBytes() const;
+		
+		private:
+			std::unique_ptr< std::fstream > file;
+			std::ostream* out;
+			
+			sf::Uint64 offset;
+			std::vector< std::pair< priv::LocalFileHeader, sf::Uint64 > > lfs;
+			std::vector< priv::CentralDirectoryStructure > existing; // When appending
+			std::string comment; // Likewise, the archive's comment, which goes in the new end record
+			std::string appendFilename;
+			sf::Uint64 skippedBytes;
+	};
+}
+
+#endif // ZIP_WRITER_HPP